@@ -285,27 +285,78 @@ MapEditorMainWindow::RightClickContextMenu(QPoint mouse_position, QPoint map_pos
         auto from = Point {12436, 2390};
         auto to = Point {3265, 5951};
 
-        m_current_route = m_router->CalculateRoute(from, to);
-        auto stats = m_router->GetStats();
-        if (!m_current_route.empty())
+        if (!m_abstract_graph)
         {
-            fmt::print("Route from {},{} to {},{} with {} expanded nodes for {} partial paths\n",
-                       from.x,
-                       from.y,
-                       to.x,
-                       to.y,
-                       stats.nodes_expanded,
-                       stats.partial_paths);
+            m_abstract_graph_data = BuildAbstractGraph(RoutingLandMask());
+            m_abstract_graph = std::make_unique<AbstractGraph>(m_abstract_graph_data);
         }
-        else
+        if (!m_landmarks)
         {
-            fmt::print("No route found between {},{} and {},{} with {} expanded nodes\n",
-                       from.x,
-                       from.y,
-                       to.x,
-                       to.y,
-                       stats.nodes_expanded);
+            m_landmarks_data = BuildLandmarks(RoutingLandMask());
+            m_landmarks = std::make_unique<Landmarks>(m_landmarks_data);
         }
+
+        struct Configuration
+        {
+            const char* name;
+            Router<kTargetCacheSize>::Engine engine;
+            const AbstractGraph* abstract_graph;
+            const Landmarks* landmarks;
+        };
+
+        // Compare the engines on the same route, and show the last one
+        for (auto [name, engine, abstract_graph, landmarks] : {
+                 Configuration {"A*", Router<kTargetCacheSize>::Engine::kAstar, nullptr, nullptr},
+                 Configuration {"A* (ALT)",
+                                Router<kTargetCacheSize>::Engine::kAstar,
+                                nullptr,
+                                m_landmarks.get()},
+                 Configuration {
+                     "JPS", Router<kTargetCacheSize>::Engine::kJumpPointSearch, nullptr, nullptr},
+                 Configuration {"Bidirectional A*",
+                                Router<kTargetCacheSize>::Engine::kBidirectional,
+                                nullptr,
+                                nullptr},
+                 Configuration {"HPA*",
+                                Router<kTargetCacheSize>::Engine::kAstar,
+                                m_abstract_graph.get(),
+                                nullptr},
+             })
+        {
+            m_router->SetEngine(engine);
+            m_router->SetAbstractGraph(abstract_graph);
+            m_router->SetLandmarks(landmarks);
+            m_current_route = m_router->CalculateRoute(from, to);
+            auto stats = m_router->GetStats();
+            if (!m_current_route.empty())
+            {
+                fmt::print("{}: Route from {},{} to {},{} with {} expanded nodes ({} scanned cells, "
+                           "{} abstract nodes, {} landmarks) for {} partial paths\n",
+                           name,
+                           from.x,
+                           from.y,
+                           to.x,
+                           to.y,
+                           stats.nodes_expanded,
+                           stats.cells_scanned,
+                           stats.abstract_nodes_expanded,
+                           stats.landmarks,
+                           stats.partial_paths);
+            }
+            else
+            {
+                fmt::print("{}: No route found between {},{} and {},{} with {} expanded nodes\n",
+                           name,
+                           from.x,
+                           from.y,
+                           to.x,
+                           to.y,
+                           stats.nodes_expanded);
+            }
+        }
+        m_router->SetEngine(Router<kTargetCacheSize>::Engine::kAstar);
+        m_router->SetAbstractGraph(nullptr);
+        m_router->SetLandmarks(nullptr);
     }
     else if (selectedAction == action_home_position)
     {
@@ -549,6 +600,11 @@ MapEditorMainWindow::SaveYaml()
     node["land_mask"] = m_land_mask_uint32;
     UpdateRoutingInformation();
 
+    // For hierarchical routing on the target
+    node["abstract_graph"] = BuildAbstractGraph(RoutingLandMask());
+    // For the ALT heuristic on the target
+    node["landmarks"] = BuildLandmarks(RoutingLandMask());
+
     std::ofstream f(m_out_yaml.toStdString());
 
     f << node;
@@ -653,6 +709,19 @@ MapEditorMainWindow::UpdateRoutingInformation()
     m_router = std::make_unique<Router<kTargetCacheSize>>(m_land_mask_uint32,
                                                           m_map->height() / kPathFinderTileSize,
                                                           m_map->width() / kPathFinderTileSize);
+    // Rebuilt when needed
+    m_abstract_graph = nullptr;
+    m_abstract_graph_data.clear();
+    m_landmarks = nullptr;
+    m_landmarks_data.clear();
+}
+
+LandMask
+MapEditorMainWindow::RoutingLandMask() const
+{
+    return LandMask(m_land_mask_uint32,
+                    m_map->width() / kPathFinderTileSize,
+                    m_map->height() / kPathFinderTileSize);
 }
 
 void
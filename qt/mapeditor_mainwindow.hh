@@ -66,6 +66,8 @@ private:
     void SetGpsPosition(double longitude, double latitude, int x, int y);
     void CalculateLand();
     void UpdateRoutingInformation();
+    // Of m_land_mask_uint32, for the map builders
+    LandMask RoutingLandMask() const;
     void AddExtraLand(int x, int y);
     void AddExtraWater(int x, int y);
     void AddSkipTile(int x, int y);
@@ -111,6 +113,10 @@ private:
     std::vector<MapGpsRasterTile> m_gps_positions;
 
     std::unique_ptr<Router<kTargetCacheSize>> m_router;
+    std::vector<uint32_t> m_abstract_graph_data;
+    std::unique_ptr<AbstractGraph> m_abstract_graph;
+    std::vector<uint32_t> m_landmarks_data;
+    std::unique_ptr<Landmarks> m_landmarks;
 
     std::span<const IndexType> m_current_route;
 };
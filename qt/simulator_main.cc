@@ -67,10 +67,20 @@ main(int argc, char* argv[])
     state.Checkout()->demo_mode = true;
 
     auto map_metadata = reinterpret_cast<const MapMetadata*>(mmap_bin);
+    if (bin_file.size() < static_cast<qint64>(sizeof(MapMetadata)) ||
+        map_metadata->magic != kMetadataMagic)
+    {
+        // Not a map, or one from an older tiler.py with another layout
+        fmt::print("{} is not a map of this version, rebuild it with tiler.py\n",
+                   map_file.toStdString());
+        return 1;
+    }
 
     fmt::print("Metadata @ {}..{}:\n  {}x{} tiles\n  {}x{} land mask\n  {}x{} GPS data\n  0x{:x} "
                "tile_data_offset\n  0x{:x}  land_mask_data_offset\n  0x{:x} "
-               "gps_position_offset\n  latitude between {}..{}\n  longitude between {}..{}\n",
+               "gps_position_offset\n  0x{:x} abstract_graph_offset ({} bytes)\n  0x{:x} "
+               "landmarks_offset ({} bytes)\n  0x{:x} block_land_mask_offset ({} bytes)\n  "
+               "latitude between {}..{}\n  longitude between {}..{}\n",
                (const void*)map_metadata,
                (const void*)((const uint8_t*)map_metadata + bin_file.size()),
                map_metadata->tile_row_size,
@@ -82,15 +92,22 @@ main(int argc, char* argv[])
                map_metadata->tile_data_offset,
                map_metadata->land_mask_data_offset,
                map_metadata->gps_position_offset,
+               map_metadata->abstract_graph_offset,
+               map_metadata->abstract_graph_size,
+               map_metadata->landmarks_offset,
+               map_metadata->landmarks_size,
+               map_metadata->block_land_mask_offset,
+               map_metadata->block_land_mask_size,
 
                map_metadata->lowest_latitude,
                map_metadata->highest_latitude,
                map_metadata->lowest_longitude,
                map_metadata->highest_longitude);
 
-    auto route_service = std::make_unique<RouteService>(*map_metadata);
+    auto route_service = std::make_unique<RouteService>(*map_metadata, state, 1);
     auto storage = std::make_unique<Storage>(*nvm, state, route_service->AttachListener());
-    auto producer = std::make_unique<TileProducer>(state, *map_metadata);
+    // More workers than on the target, the host has the cores for it
+    auto producer = std::make_unique<TileProducer>(state, *map_metadata, 3);
     auto gps_simulator = std::make_unique<GpsSimulator>(*map_metadata, state, *route_service);
     auto gps_listener = std::make_unique<GpsListener>(*gps_simulator);
 
@@ -101,6 +118,8 @@ main(int argc, char* argv[])
     auto uart_event_listener = std::make_unique<UartEventListener>(uart_a);
     auto uart_event_forwarder = std::make_unique<UartEventForwarder>(uart_b, window, *gps_listener);
     auto gps_reader = std::make_unique<GpsReader>(*map_metadata, *uart_event_listener);
+    route_service->AttachGpsPort(gps_reader->AttachListener());
+    producer->AttachGpsPort(gps_reader->AttachListener());
 
     auto ui = std::make_unique<UserInterface>(state,
                                               *map_metadata,
@@ -21,15 +21,16 @@ GpsSimulator::GpsSimulator(const MapMetadata& metadata,
 std::optional<milliseconds>
 GpsSimulator::OnActivation()
 {
+    // Intermediate routes are skipped: the demo starts at the beginning of the route, so following
+    // one would make the boat jump back when the final route arrives
     while (auto route = m_route_listener->Poll())
     {
         if (route->type == IRouteListener::EventType::kReady)
         {
             m_route_iterator = nullptr;
             m_next_position = std::nullopt;
-            m_route.clear();
-            std::ranges::copy(route->route, std::back_inserter(m_route));
-            m_route_iterator = m_route_service.CreateRouteIterator(m_route);
+            m_route = route->route;
+            m_route_iterator = m_route_service.CreateRouteIterator(m_route.Span());
             if (auto pos = m_route_iterator->Next(); pos.has_value())
             {
                 m_position = *pos;
@@ -44,11 +45,11 @@ GpsSimulator::OnActivation()
             }
             m_route_pending = false;
         }
-        else
+        else if (route->type == IRouteListener::EventType::kCalculating)
         {
             m_route_pending = true;
             m_route_iterator = nullptr;
-            m_route.clear();
+            m_route = {};
             m_next_position = std::nullopt;
         }
     }
@@ -199,6 +200,11 @@ GpsSimulator::RunDemo()
             m_route_iterator = nullptr;
         }
     }
+    else if (m_next_position)
+    {
+        // Steer towards the next point, since the route legs are not limited to 8 directions
+        m_direction = PointPairToVector(m_position, *m_next_position);
+    }
 
     m_position = m_position + m_direction;
     m_has_data_semaphore.release();
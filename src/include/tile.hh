@@ -14,8 +14,17 @@ constexpr auto kPathFinderTileSize = kTileSize / 10;
 using IndexType = uint32_t;
 using CostType = uint32_t;
 
-// TILRSWFT
-constexpr auto kMetadataMagic = 0x54494C5253574654ull;
+// TILRSWF2. Changed with the layout of MapMetadata, so that maps from an older tiler.py are
+// rejected instead of misread (was TILRSWFT for the 64 byte metadata)
+constexpr auto kMetadataMagic = 0x54494C5253574632ull;
+
+// How the tiles are stored in the map
+enum class TileCodec : uint32_t
+{
+    kPng,
+    // Run-length encoded palette indices (tile_codec.hh)
+    kRle,
+};
 
 struct FlashTile
 {
@@ -56,10 +65,29 @@ struct MapMetadata
     uint32_t tile_data_offset;
     uint32_t land_mask_data_offset;
     uint32_t gps_position_offset;
+
+    // The abstract routing graph (0 if not present), size in bytes
+    uint32_t abstract_graph_offset;
+    uint32_t abstract_graph_size;
+
+    // The landmark distance tables (0 if not present), size in bytes
+    uint32_t landmarks_offset;
+    uint32_t landmarks_size;
+
+    // The block-sparse land mask (0 if not present), size in bytes
+    uint32_t block_land_mask_offset;
+    uint32_t block_land_mask_size;
+
+    TileCodec tile_codec;
+    uint32_t reserved;
 };
 static_assert(offsetof(MapMetadata, tile_count) == 24);
 static_assert(offsetof(MapMetadata, land_mask_data_offset) == 56);
-static_assert(sizeof(MapMetadata) == 64);
+static_assert(offsetof(MapMetadata, abstract_graph_offset) == 64);
+static_assert(offsetof(MapMetadata, landmarks_offset) == 72);
+static_assert(offsetof(MapMetadata, block_land_mask_offset) == 80);
+static_assert(offsetof(MapMetadata, tile_codec) == 88);
+static_assert(sizeof(MapMetadata) == 96);
 
 struct Point
 {
@@ -3,6 +3,8 @@
 #include "image.hh"
 #include "tile.hh"
 
+#include <span>
+
 namespace painter
 {
 
@@ -14,10 +16,79 @@ struct Rect
     int32_t height;
 };
 
+// Palette indices, drawn with the palette, except on the right-slanted stripes ((x + y) % 6 < 2)
+// which use the stripe palette
+class IndexedImage
+{
+public:
+    IndexedImage(std::span<const uint8_t> indices,
+                 int32_t width,
+                 int32_t height,
+                 std::span<const uint16_t> palette,
+                 std::span<const uint16_t> stripe_palette)
+        : m_indices(indices)
+        , m_width(width)
+        , m_height(height)
+        , m_palette(palette)
+        , m_stripe_palette(stripe_palette)
+    {
+    }
+
+    auto Width() const
+    {
+        return m_width;
+    }
+
+    auto Height() const
+    {
+        return m_height;
+    }
+
+    bool HasStripes() const
+    {
+        return m_palette.data() != m_stripe_palette.data();
+    }
+
+    uint16_t Pixel(int32_t x, int32_t y) const
+    {
+        const auto& palette = (x + y) % 6 < 2 ? m_stripe_palette : m_palette;
+
+        return palette[m_indices[y * m_width + x]];
+    }
+
+    // Without stripes
+    std::span<const uint8_t> Row(int32_t y) const
+    {
+        return m_indices.subspan(y * m_width, m_width);
+    }
+
+    std::span<const uint16_t> Palette() const
+    {
+        return m_palette;
+    }
+
+private:
+    std::span<const uint8_t> m_indices;
+    int32_t m_width;
+    int32_t m_height;
+    std::span<const uint16_t> m_palette;
+    std::span<const uint16_t> m_stripe_palette;
+};
+
 
 void Blit(uint16_t* frame_buffer, const Image& image, Rect to);
 
+void Blit(uint16_t* frame_buffer, const IndexedImage& image, Rect to);
+
+void Fill(uint16_t* frame_buffer, uint16_t color, Rect to);
+
 void ZoomedBlit(
     uint16_t* frame_buffer, uint32_t buffer_width, const Image& image, unsigned factor, Rect to);
 
+void ZoomedBlit(uint16_t* frame_buffer,
+                uint32_t buffer_width,
+                const IndexedImage& image,
+                unsigned factor,
+                Rect to);
+
 } // namespace painter
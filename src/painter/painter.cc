@@ -3,6 +3,7 @@
 
 #include "hal/i_display.hh"
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 #include <array>
@@ -50,32 +51,24 @@ Prepare(const auto& image, auto& to)
     return std::array {height, width, from_y, from_x, row_length};
 }
 
-} // namespace
-
-namespace painter
+auto
+PixelAt(const Image& image, int32_t x, int32_t y)
 {
+    return image.Data16()[y * image.Width() + x];
+}
 
-void
-Blit(uint16_t* frame_buffer, const Image& image, Rect to)
+auto
+PixelAt(const painter::IndexedImage& image, int32_t x, int32_t y)
 {
-    auto [height, width, from_y, from_x, row_length] = Prepare(image, to);
-
-    auto src_buffer = image.Data16().data();
-    auto image_width = image.Width();
-
-    for (int y = 0; y < height; ++y)
-    {
-        uint32_t dst_y = to.y + y;
-
-        memcpy(&frame_buffer[dst_y * hal::kDisplayWidth + to.x],
-               &src_buffer[(from_y + y) * image_width + from_x],
-               row_length * sizeof(uint16_t));
-    }
+    return image.Pixel(x, y);
 }
 
 void
-ZoomedBlit(
-    uint16_t* frame_buffer, uint32_t buffer_width, const Image& image, unsigned factor, Rect to)
+ZoomedBlitImpl(uint16_t* frame_buffer,
+               uint32_t buffer_width,
+               const auto& image,
+               unsigned factor,
+               painter::Rect to)
 {
     // height and width are unused
     auto [_0, _1, from_y, from_x, row_length] = Prepare(image, to);
@@ -104,10 +97,91 @@ ZoomedBlit(
                 continue;
             }
 
-            auto src_color = image.Data16()[src_y * image.Width() + src_x];
-            frame_buffer[dst_y * buffer_width + dst_x] = src_color;
+            frame_buffer[dst_y * buffer_width + dst_x] = PixelAt(image, src_x, src_y);
+        }
+    }
+}
+
+} // namespace
+
+namespace painter
+{
+
+void
+Blit(uint16_t* frame_buffer, const Image& image, Rect to)
+{
+    auto [height, width, from_y, from_x, row_length] = Prepare(image, to);
+
+    auto src_buffer = image.Data16().data();
+    auto image_width = image.Width();
+
+    for (int y = 0; y < height; ++y)
+    {
+        uint32_t dst_y = to.y + y;
+
+        memcpy(&frame_buffer[dst_y * hal::kDisplayWidth + to.x],
+               &src_buffer[(from_y + y) * image_width + from_x],
+               row_length * sizeof(uint16_t));
+    }
+}
+
+void
+Fill(uint16_t* frame_buffer, uint16_t color, Rect to)
+{
+    auto x_start = std::max(to.x, static_cast<int32_t>(0));
+    auto x_end = std::min(to.x + to.width, static_cast<int32_t>(hal::kDisplayWidth));
+    auto y_start = std::max(to.y, static_cast<int32_t>(0));
+    auto y_end = std::min(to.y + to.height, static_cast<int32_t>(hal::kDisplayHeight));
+
+    for (auto y = y_start; y < y_end; ++y)
+    {
+        std::fill(&frame_buffer[y * hal::kDisplayWidth + x_start],
+                  &frame_buffer[y * hal::kDisplayWidth + x_end],
+                  color);
+    }
+}
+
+void
+Blit(uint16_t* frame_buffer, const IndexedImage& image, Rect to)
+{
+    auto [height, width, from_y, from_x, row_length] = Prepare(image, to);
+
+    for (int y = 0; y < height; ++y)
+    {
+        auto dst = &frame_buffer[(to.y + y) * hal::kDisplayWidth + to.x];
+
+        if (image.HasStripes())
+        {
+            for (auto x = 0; x < row_length; x++)
+            {
+                dst[x] = image.Pixel(from_x + x, from_y + y);
+            }
+        }
+        else
+        {
+            const auto row = image.Row(from_y + y).subspan(from_x, row_length);
+            const auto palette = image.Palette();
+
+            std::ranges::transform(row, dst, [&palette](auto index) { return palette[index]; });
         }
     }
 }
 
+void
+ZoomedBlit(
+    uint16_t* frame_buffer, uint32_t buffer_width, const Image& image, unsigned factor, Rect to)
+{
+    ZoomedBlitImpl(frame_buffer, buffer_width, image, factor, to);
+}
+
+void
+ZoomedBlit(uint16_t* frame_buffer,
+           uint32_t buffer_width,
+           const IndexedImage& image,
+           unsigned factor,
+           Rect to)
+{
+    ZoomedBlitImpl(frame_buffer, buffer_width, image, factor, to);
+}
+
 } // namespace painter
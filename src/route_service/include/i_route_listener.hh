@@ -1,8 +1,11 @@
 #pragma once
 
+#include "route_buffer.hh"
 #include "router.hh"
 #include "semaphore.hh"
 
+#include <cstdint>
+#include <limits>
 #include <optional>
 #include <span>
 
@@ -12,17 +15,25 @@ public:
     enum class EventType
     {
         kCalculating,
+        // A usable route, while a better one is being calculated
+        kIntermediate,
         kReady,
 
         kValueCount,
     };
 
+    // The request of routes not asked for (repaired ones)
+    static constexpr uint32_t kNoRequest = std::numeric_limits<uint32_t>::max();
+
     struct Event
     {
         EventType type;
 
-        // Valid if kRouteReady (copy it)
-        std::span<const IndexType> route;
+        // As returned by RouteService::RequestRoute(). Only the newest request gets its routes
+        uint32_t request;
+
+        // Set if kIntermediate or kReady, and shared with the other listeners
+        RouteBuffer route;
     };
 
 
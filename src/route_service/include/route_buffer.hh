@@ -0,0 +1,77 @@
+#pragma once
+
+#include "tile.hh"
+
+#include <atomic>
+#include <memory>
+#include <span>
+#include <vector>
+
+// The storage behind a RouteBuffer, either in a RouteArena or on its own on the heap
+struct RouteBufferSlot
+{
+    std::atomic<unsigned> references {0};
+    std::vector<IndexType> route;
+    bool pooled {true};
+};
+
+// A published route, shared by all listeners without copying it. It can't be changed, and stays
+// valid as long as any copy of the buffer is kept
+class RouteBuffer
+{
+public:
+    RouteBuffer() = default;
+
+    RouteBuffer(const RouteBuffer& other);
+
+    RouteBuffer(RouteBuffer&& other) noexcept;
+
+    ~RouteBuffer();
+
+    RouteBuffer& operator=(const RouteBuffer& other);
+
+    RouteBuffer& operator=(RouteBuffer&& other) noexcept;
+
+    // Empty for the default constructed buffer
+    std::span<const IndexType> Span() const
+    {
+        if (!m_slot)
+        {
+            return {};
+        }
+
+        return m_slot->route;
+    }
+
+private:
+    friend class RouteArena;
+
+    // Takes over a reference
+    explicit RouteBuffer(RouteBufferSlot* slot);
+
+    void Release();
+
+    RouteBufferSlot* m_slot {nullptr};
+};
+
+// Route buffers allocated up front (in PSRAM with the route service), and reused when all their
+// references are gone. Routes don't fragment the heap then
+class RouteArena
+{
+public:
+    // Must outlive the buffers it hands out
+    RouteArena(unsigned count, size_t capacity);
+
+    // Context: One thread at a time. A copy of route, on the heap if all buffers are taken or it
+    // is too long for them
+    RouteBuffer Allocate(std::span<const IndexType> route);
+
+    // Buffers without references
+    unsigned FreeCount() const;
+
+private:
+    const unsigned m_count;
+    const size_t m_capacity;
+    std::unique_ptr<RouteBufferSlot[]> m_slots;
+    unsigned m_next {0};
+};
@@ -1,21 +1,59 @@
 #pragma once
 
+#include "application_state.hh"
 #include "base_thread.hh"
+#include "gps_port.hh"
 #include "i_route_listener.hh"
+#include "route_cache.hh"
 #include "route_iterator.hh"
 #include "tile.hh"
 
+#include <etl/deque.h>
 #include <etl/mutex.h>
 #include <etl/queue_spsc_atomic.h>
 #include <etl/vector.h>
+#include <array>
+#include <atomic>
+#include <tuple>
 
 class RouteService : public os::BaseThread
 {
 public:
-    RouteService(const MapMetadata& metadata);
+    static constexpr auto kMetricsHistory = 16;
 
-    // Context: Another thread
-    void RequestRoute(Point from, Point to);
+    // What a route search took, to tune the node cache and the costs
+    struct RouteMetrics
+    {
+        uint32_t request;
+        // In percent, 100 for the cheapest route
+        unsigned heuristic_weight;
+        milliseconds time;
+        unsigned nodes_expanded;
+        unsigned partial_paths;
+        unsigned open_set_high_water;
+        // Node cache entries (of kTargetCacheSize)
+        unsigned nodes_used;
+        unsigned points;
+    };
+
+    // With workers, routes are also calculated on threads of their own (each with a router, so a
+    // node cache, of its own)
+    RouteService(const MapMetadata& metadata,
+                 ApplicationState& application_state,
+                 unsigned workers = 0);
+
+    ~RouteService() override;
+
+    // Context: Any thread. Never blocks, and returns the request of the events for it. A newer
+    // request supersedes it, so it then gets no more routes (and is dropped if not yet started)
+    uint32_t RequestRoute(Point from, Point to);
+
+    // The memory for recently calculated routes, which are reused for requests starting and
+    // ending close to theirs
+    void SetRouteCacheBudget(size_t bytes);
+
+    // Follow the boat, and repair the route when it leaves it (before Start())
+    void AttachGpsPort(std::unique_ptr<IGpsPort> gps_port);
 
     // Helper to create a route iterator
     std::unique_ptr<RouteIterator> CreateRouteIterator(std::span<const IndexType> route) const;
@@ -30,20 +68,134 @@ public:
 
     std::unique_ptr<IRouteListener> AttachListener();
 
+    // Context: Any thread. The latest searches, oldest first
+    etl::vector<RouteMetrics, kMetricsHistory> GetMetrics() const;
+
+    // Also print the metrics of each search as it finishes
+    void SetMetricsPrinting(bool print);
+
 private:
     class RouteListenerImpl;
+    class Worker;
+
+    // One search for a request, with the heuristic weight of step (anytime routing)
+    struct Job
+    {
+        uint32_t request;
+        IndexType from;
+        IndexType to;
+        unsigned step;
+    };
+
+    // Quick first, then the cheapest route. With workers, only the first and last, in parallel
+    static constexpr std::array kHeuristicWeights = {300u, 150u, 100u};
+    // Bounds the first search, to show a route quickly. Without a route by then, the next step is
+    // waited for instead
+    static constexpr auto kFirstStepTime = 200ms;
+    static constexpr auto kMaxRequests = 8;
+    // Published routes, shared with the listeners. More are put on the heap
+    static constexpr auto kRouteBuffers = 16;
+    static constexpr auto kRouteBufferCapacity = 512;
+    static constexpr auto kNoRequest = IRouteListener::kNoRequest;
+
+    void OnStartup() final;
 
     std::optional<milliseconds> OnActivation() final;
 
+    std::unique_ptr<Router<kTargetCacheSize>> CreateRouter() const;
+
+    void QueueJob(const Job& job);
+
+    // The jobs for a request: the steps one after another, or with workers the first and the last
+    // in parallel
+    void QueueJobs(uint32_t request, IndexType from, IndexType to);
+
+    // Context: Any route thread. Run a queued job on the router of the calling thread, false if
+    // there was none. The cached routes are updated when there are no route jobs
+    bool RunJob(Router<kTargetCacheSize>& router, bool update_cached_routes = true);
+
+    // No requests queued or being calculated
+    bool IsIdle();
+
+    // Context: Any route thread
+    void RecordMetrics(const RouteMetrics& metrics);
+
+    // Context: Any route thread
+    void Publish(uint32_t request,
+                 IRouteListener::EventType type,
+                 std::span<const IndexType> route);
+
+    // Repair the route when the boat has left it. True if a new route was queued instead
+    bool FollowPosition(IndexType position);
+
+    // Home and the stored positions
+    std::vector<IndexType> CachedDestinations() const;
+
+    // Update the cached routes as a job, run when there are no routes to calculate. False if they
+    // are still good
+    bool QueueCachedRoutesUpdate(IndexType position);
+
+    // Context: Any route thread
+    void UpdateCachedRoutes(Router<kTargetCacheSize>& router, IndexType position);
+
+    // Of the cached routes, with a local search from the exact start. Empty if that fails
+    std::span<const IndexType> CachedRoute(IndexType from, IndexType to);
+
+    // From the route cache, with local searches to the exact start and destination. Empty if these
+    // fail
+    std::vector<IndexType> RecentRoute(IndexType from, IndexType to);
+
 
     const uint32_t m_row_size;
     const uint32_t m_rows;
-    std::vector<uint32_t> m_land_mask;
+    std::vector<uint32_t> m_land_mask_data;
+    std::unique_ptr<LandMask> m_land_mask;
 
-    os::binary_semaphore m_calculating_semaphore {1};
-    etl::queue_spsc_atomic<std::pair<IndexType, IndexType>, 8> m_requested_route;
     etl::vector<RouteListenerImpl*, 4> m_listeners;
 
+    // Requests and jobs, shared with the workers
+    etl::mutex m_job_mutex;
+    etl::deque<std::tuple<uint32_t, IndexType, IndexType>, kMaxRequests> m_requests;
+    etl::deque<Job, 2 * kMaxRequests> m_jobs;
+    uint32_t m_next_request {0};
+    unsigned m_running_jobs {0};
+    RouteCache m_route_cache;
+
+    // Protects the listener queues, m_route and the published routes
+    etl::mutex m_publish_mutex;
+    RouteArena m_route_arena {kRouteBuffers, kRouteBufferCapacity};
+    RouteBuffer m_last_published;
+    uint32_t m_last_published_request {kNoRequest};
+    // Routes of older requests are dropped, they have been superseded
+    uint32_t m_newest_request {0};
+    // Requests with a published final route, so that late intermediate routes are dropped
+    std::array<uint32_t, kMaxRequests> m_finished_requests;
+    unsigned m_next_finished {0};
+
+    mutable etl::mutex m_metrics_mutex;
+    std::array<RouteMetrics, kMetricsHistory> m_metrics;
+    unsigned m_metrics_count {0};
+    std::atomic_bool m_print_metrics {false};
+
+    ApplicationState& m_application_state;
+    std::unique_ptr<ApplicationState::IListener> m_application_state_listener;
+
+    std::unique_ptr<IGpsPort> m_gps_port;
+    // The route being followed (empty when there is none, or at the destination). Under
+    // m_publish_mutex
+    RouteBuffer m_route;
+
+    // Routes to home and the stored positions, from m_cache_origin. Under m_job_mutex
+    std::optional<IndexType> m_cached_routes_position;
+    bool m_updating_cached_routes {false};
+    std::vector<IndexType> m_cached_destinations;
+    std::vector<std::vector<IndexType>> m_cached_routes;
+    std::optional<IndexType> m_cache_origin;
+
+    std::unique_ptr<AbstractGraph> m_abstract_graph;
+    std::unique_ptr<Landmarks> m_landmarks;
+
     // Unique, to place this class in PSRAM
     std::unique_ptr<Router<kTargetCacheSize>> m_router;
+    std::vector<std::unique_ptr<Worker>> m_workers;
 };
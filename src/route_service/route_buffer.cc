@@ -0,0 +1,128 @@
+#include "route_buffer.hh"
+
+RouteBuffer::RouteBuffer(RouteBufferSlot* slot)
+    : m_slot(slot)
+{
+}
+
+RouteBuffer::RouteBuffer(const RouteBuffer& other)
+    : m_slot(other.m_slot)
+{
+    if (m_slot)
+    {
+        m_slot->references.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+RouteBuffer::RouteBuffer(RouteBuffer&& other) noexcept
+    : m_slot(other.m_slot)
+{
+    other.m_slot = nullptr;
+}
+
+RouteBuffer::~RouteBuffer()
+{
+    Release();
+}
+
+RouteBuffer&
+RouteBuffer::operator=(const RouteBuffer& other)
+{
+    // Before releasing, which also clears other on self assignment
+    auto slot = other.m_slot;
+
+    if (slot)
+    {
+        slot->references.fetch_add(1, std::memory_order_relaxed);
+    }
+    Release();
+    m_slot = slot;
+
+    return *this;
+}
+
+RouteBuffer&
+RouteBuffer::operator=(RouteBuffer&& other) noexcept
+{
+    if (this != &other)
+    {
+        Release();
+        m_slot = other.m_slot;
+        other.m_slot = nullptr;
+    }
+
+    return *this;
+}
+
+void
+RouteBuffer::Release()
+{
+    if (!m_slot)
+    {
+        return;
+    }
+
+    // Can be reused by the arena as soon as the references are gone
+    const auto pooled = m_slot->pooled;
+
+    if (m_slot->references.fetch_sub(1, std::memory_order_acq_rel) == 1 && !pooled)
+    {
+        delete m_slot;
+    }
+    m_slot = nullptr;
+}
+
+
+RouteArena::RouteArena(unsigned count, size_t capacity)
+    : m_count(count)
+    , m_capacity(capacity)
+    , m_slots(std::make_unique<RouteBufferSlot[]>(count))
+{
+    for (auto i = 0u; i < m_count; i++)
+    {
+        m_slots[i].route.reserve(m_capacity);
+    }
+}
+
+RouteBuffer
+RouteArena::Allocate(std::span<const IndexType> route)
+{
+    if (route.size() <= m_capacity)
+    {
+        for (auto i = 0u; i < m_count; i++)
+        {
+            auto& slot = m_slots[(m_next + i) % m_count];
+            unsigned free = 0;
+
+            if (slot.references.compare_exchange_strong(free, 1, std::memory_order_acquire))
+            {
+                // Within the capacity, so no allocation
+                slot.route.assign(route.begin(), route.end());
+                m_next = (m_next + i + 1) % m_count;
+
+                return RouteBuffer(&slot);
+            }
+        }
+    }
+
+    auto slot = new RouteBufferSlot;
+
+    slot->references = 1;
+    slot->route.assign(route.begin(), route.end());
+    slot->pooled = false;
+
+    return RouteBuffer(slot);
+}
+
+unsigned
+RouteArena::FreeCount() const
+{
+    auto out = 0u;
+
+    for (auto i = 0u; i < m_count; i++)
+    {
+        out += m_slots[i].references.load(std::memory_order_relaxed) == 0;
+    }
+
+    return out;
+}
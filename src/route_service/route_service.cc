@@ -2,14 +2,23 @@
 
 #include "route_utils.hh"
 
+#include <algorithm>
+#include <cstdio>
 #include <cstdlib>
+#include <mutex>
+#include <utility>
+
+// Repair the route when the boat is further away from it than this (in land mask cells)
+constexpr auto kOffRouteDistance = 3u;
+// Update the cached routes when the boat has moved this far from where they start
+constexpr auto kRecacheDistance = 32u;
 
 class RouteService::RouteListenerImpl : public IRouteListener
 {
 public:
-    void PushEvent(IRouteListener::EventType event, std::span<const IndexType> route)
+    void PushEvent(IRouteListener::EventType event, uint32_t request, const RouteBuffer& route)
     {
-        m_events.push({event, route});
+        m_events.push({event, request, route});
         if (m_semaphore)
         {
             m_semaphore->release();
@@ -35,33 +44,133 @@ private:
     }
 
     os::binary_semaphore* m_semaphore {nullptr};
-    etl::queue_spsc_atomic<IRouteListener::Event, 4> m_events;
+    etl::queue_spsc_atomic<IRouteListener::Event, 8> m_events;
+};
+
+
+class RouteService::Worker : public os::BaseThread
+{
+public:
+    explicit Worker(RouteService& parent)
+        : m_parent(parent)
+        , m_router(parent.CreateRouter())
+    {
+    }
+
+private:
+    std::optional<milliseconds> OnActivation() final
+    {
+        if (m_parent.RunJob(*m_router))
+        {
+            return 0ms;
+        }
+
+        return std::nullopt;
+    }
+
+    RouteService& m_parent;
+    std::unique_ptr<Router<kTargetCacheSize>> m_router;
 };
 
 
-RouteService::RouteService(const MapMetadata& metadata)
+RouteService::RouteService(const MapMetadata& metadata,
+                           ApplicationState& application_state,
+                           unsigned workers)
     : m_row_size(metadata.land_mask_row_size)
     , m_rows(metadata.land_mask_rows)
+    , m_route_cache(m_row_size)
+    , m_application_state(application_state)
 {
-    // Copy the land mask to PSRAM for faster access (~330KiB)
-    m_land_mask.resize((m_rows * m_row_size) / 32);
-    auto p = reinterpret_cast<const uint8_t*>(&metadata) + metadata.land_mask_data_offset;
-    memcpy(m_land_mask.data(), p, m_land_mask.size() * sizeof(uint32_t));
+    m_application_state_listener = m_application_state.AttachListener(GetSemaphore());
+    m_finished_requests.fill(kNoRequest);
 
-    m_router = std::make_unique<Router<kTargetCacheSize>>(
-        m_land_mask, metadata.land_mask_rows, metadata.land_mask_row_size);
+    if (metadata.block_land_mask_offset != 0)
+    {
+        // Copy the land mask to PSRAM for faster access. Only the blocks with both land and water
+        // take space, so it grows with the coast line rather than with the map
+        m_land_mask_data.resize(metadata.block_land_mask_size / sizeof(uint32_t));
+        auto p = reinterpret_cast<const uint8_t*>(&metadata) + metadata.block_land_mask_offset;
+        memcpy(m_land_mask_data.data(), p, m_land_mask_data.size() * sizeof(uint32_t));
+
+        m_land_mask = std::make_unique<LandMask>(m_land_mask_data);
+    }
+
+    if (!m_land_mask || !m_land_mask->IsValid())
+    {
+        // The plain one (~340KiB, see doc/ram.md)
+        m_land_mask_data.resize((m_rows * m_row_size) / 32);
+        auto p = reinterpret_cast<const uint8_t*>(&metadata) + metadata.land_mask_data_offset;
+        memcpy(m_land_mask_data.data(), p, m_land_mask_data.size() * sizeof(uint32_t));
+
+        m_land_mask = std::make_unique<LandMask>(m_land_mask_data, m_row_size, m_rows);
+    }
+
+    if (metadata.abstract_graph_offset != 0)
+    {
+        // Used directly from flash (the edges are only touched by the search)
+        auto graph = reinterpret_cast<const uint32_t*>(reinterpret_cast<const uint8_t*>(&metadata) +
+                                                       metadata.abstract_graph_offset);
+
+        m_abstract_graph = std::make_unique<AbstractGraph>(
+            std::span<const uint32_t>(graph, metadata.abstract_graph_size / sizeof(uint32_t)));
+    }
+
+    if (metadata.landmarks_offset != 0)
+    {
+        auto landmarks = reinterpret_cast<const uint32_t*>(
+            reinterpret_cast<const uint8_t*>(&metadata) + metadata.landmarks_offset);
+
+        m_landmarks = std::make_unique<Landmarks>(
+            std::span<const uint32_t>(landmarks, metadata.landmarks_size / sizeof(uint32_t)));
+    }
+
+    m_router = CreateRouter();
+
+    // The land mask, abstract graph and landmarks are read-only, so shared by all routers
+    for (auto i = 0u; i < workers; i++)
+    {
+        m_workers.push_back(std::make_unique<Worker>(*this));
+    }
 }
 
-void
+RouteService::~RouteService() = default;
+
+uint32_t
 RouteService::RequestRoute(Point from, Point to)
 {
-    m_calculating_semaphore.acquire();
+    uint32_t request;
 
-    // Context: Another thread
-    m_requested_route.push(
-        std::make_pair(PointToLandIndex(from, m_row_size), PointToLandIndex(to, m_row_size)));
+    {
+        std::lock_guard lock(m_job_mutex);
+
+        if (m_requests.full())
+        {
+            // Only the latest ones matter
+            m_requests.pop_front();
+        }
+        request = m_next_request++;
+        m_requests.push_back(std::make_tuple(
+            request, PointToLandIndex(from, m_row_size), PointToLandIndex(to, m_row_size)));
+    }
 
     Awake();
+
+    return request;
+}
+
+void
+RouteService::SetRouteCacheBudget(size_t bytes)
+{
+    std::lock_guard lock(m_job_mutex);
+
+    m_route_cache.SetBudget(bytes);
+}
+
+void
+RouteService::AttachGpsPort(std::unique_ptr<IGpsPort> gps_port)
+{
+    m_gps_port = std::move(gps_port);
+    m_gps_port->AwakeOn(GetSemaphore());
 }
 
 std::unique_ptr<IRouteListener>
@@ -75,31 +184,517 @@ RouteService::AttachListener()
     return out;
 }
 
+void
+RouteService::OnStartup()
+{
+    // The other core, at low priority to keep the UI and the tiles responsive
+    for (auto& worker : m_workers)
+    {
+        worker->Start(1, os::ThreadPriority::kLow, 5000);
+    }
+}
+
 std::optional<milliseconds>
 RouteService::OnActivation()
 {
-    std::pair<IndexType, IndexType> route_request;
+    auto queued = false;
 
-    if (m_requested_route.pop(route_request))
+    while (true)
     {
-        auto [from, to] = route_request;
+        std::tuple<uint32_t, IndexType, IndexType> route_request;
 
-        for (auto listener : m_listeners)
         {
-            listener->PushEvent(IRouteListener::EventType::kCalculating, {});
+            std::lock_guard lock(m_job_mutex);
+
+            if (m_requests.empty())
+            {
+                break;
+            }
+            route_request = m_requests.front();
+            m_requests.pop_front();
+
+            // All queued jobs are for older requests, which this one supersedes. Running ones
+            // finish, but their routes are not published
+            m_jobs.clear();
         }
-        auto route = m_router->CalculateRoute(from, to);
 
-        for (auto listener : m_listeners)
+        auto [request, from, to] = route_request;
+
+        Publish(request, IRouteListener::EventType::kCalculating, {});
+
+        if (auto route = CachedRoute(from, to); !route.empty())
+        {
+            Publish(request, IRouteListener::EventType::kReady, route);
+            continue;
+        }
+        if (auto route = RecentRoute(from, to); !route.empty())
         {
-            listener->PushEvent(IRouteListener::EventType::kReady, route);
+            Publish(request, IRouteListener::EventType::kReady, route);
+            continue;
+        }
+
+        QueueJobs(request, from, to);
+        queued = true;
+    }
+
+    if (queued)
+    {
+        for (auto& worker : m_workers)
+        {
+            worker->Awake();
+        }
+    }
+
+    // With workers, the cached routes are left to them
+    if (RunJob(*m_router, m_workers.empty()))
+    {
+        // Continue soon, but after checking for new requests
+        return 0ms;
+    }
+
+    if (m_gps_port)
+    {
+        if (auto position = m_gps_port->Poll(); position && IsIdle())
+        {
+            const auto index = PointToLandIndex(position->pixel_position, m_row_size);
+
+            if (FollowPosition(index))
+            {
+                // A new route is being calculated
+                return 0ms;
+            }
+            if (QueueCachedRoutesUpdate(index) && m_workers.empty())
+            {
+                // Run as a job by this thread, after checking for new requests
+                return 0ms;
+            }
         }
-        m_calculating_semaphore.release();
     }
 
     return std::nullopt;
 }
 
+std::unique_ptr<Router<kTargetCacheSize>>
+RouteService::CreateRouter() const
+{
+    auto router = std::make_unique<Router<kTargetCacheSize>>(*m_land_mask);
+
+    // Fewer route points to follow and draw, and more natural courses
+    router->SetSmoothing(true);
+    router->SetAbstractGraph(m_abstract_graph.get());
+    router->SetLandmarks(m_landmarks.get());
+
+    return router;
+}
+
+void
+RouteService::QueueJob(const Job& job)
+{
+    std::optional<Job> dropped;
+
+    {
+        std::lock_guard lock(m_job_mutex);
+
+        // Not expected, since the jobs of superseded requests are dropped
+        if (m_jobs.full())
+        {
+            dropped = m_jobs.front();
+            m_jobs.pop_front();
+        }
+        m_jobs.push_back(job);
+    }
+
+    if (dropped)
+    {
+        // Without a route, but the listeners waiting for one are told it's done
+        Publish(dropped->request, IRouteListener::EventType::kReady, {});
+    }
+}
+
+void
+RouteService::QueueJobs(uint32_t request, IndexType from, IndexType to)
+{
+    QueueJob({request, from, to, 0});
+    if (!m_workers.empty())
+    {
+        // The quick route and the cheapest one at the same time
+        QueueJob({request, from, to, kHeuristicWeights.size() - 1});
+    }
+}
+
+bool
+RouteService::RunJob(Router<kTargetCacheSize>& router, bool update_cached_routes)
+{
+    Job job;
+    std::optional<IndexType> cached_routes_position;
+
+    {
+        std::lock_guard lock(m_job_mutex);
+
+        if (!m_jobs.empty())
+        {
+            job = m_jobs.front();
+            m_jobs.pop_front();
+            m_running_jobs++;
+        }
+        else if (update_cached_routes && m_cached_routes_position && !m_updating_cached_routes)
+        {
+            // Only when there are no routes to calculate, and one at a time
+            cached_routes_position = std::exchange(m_cached_routes_position, std::nullopt);
+            m_updating_cached_routes = true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    if (cached_routes_position)
+    {
+        UpdateCachedRoutes(router, *cached_routes_position);
+
+        return true;
+    }
+
+    const auto last = job.step == kHeuristicWeights.size() - 1;
+    const auto before = os::GetTimeStamp();
+
+    router.SetHeuristicWeight(kHeuristicWeights[job.step]);
+    if (job.step == 0 && !last)
+    {
+        router.SetTimeLimit([before]() { return os::GetTimeStamp() - before >= kFirstStepTime; });
+    }
+    auto route = router.CalculateRoute(job.from, job.to);
+    router.SetHeuristicWeight(100);
+    router.SetTimeLimit({});
+
+    const auto stats = router.GetStats();
+    RecordMetrics({job.request,
+                   kHeuristicWeights[job.step],
+                   os::GetTimeStamp() - before,
+                   stats.nodes_expanded,
+                   stats.partial_paths,
+                   stats.open_set_high_water,
+                   stats.nodes_used,
+                   static_cast<unsigned>(route.size())});
+
+    if (last || (route.empty() && !stats.expansion_limit_reached && m_workers.empty()))
+    {
+        // Unreachable destinations will not get any better. In parallel, the last job says so
+        Publish(job.request, IRouteListener::EventType::kReady, route);
+    }
+    else
+    {
+        // Nothing to show when the first search gave up, but the next ones are not limited
+        if (!route.empty())
+        {
+            Publish(job.request, IRouteListener::EventType::kIntermediate, route);
+        }
+        if (m_workers.empty())
+        {
+            QueueJob({job.request, job.from, job.to, job.step + 1});
+        }
+    }
+
+    std::lock_guard lock(m_job_mutex);
+    if (last)
+    {
+        m_route_cache.Insert(job.from, job.to, route);
+    }
+    m_running_jobs--;
+
+    return true;
+}
+
+etl::vector<RouteService::RouteMetrics, RouteService::kMetricsHistory>
+RouteService::GetMetrics() const
+{
+    std::lock_guard lock(m_metrics_mutex);
+    etl::vector<RouteMetrics, kMetricsHistory> out;
+
+    const auto count = std::min<unsigned>(m_metrics_count, kMetricsHistory);
+    for (auto i = m_metrics_count - count; i < m_metrics_count; i++)
+    {
+        out.push_back(m_metrics[i % kMetricsHistory]);
+    }
+
+    return out;
+}
+
+void
+RouteService::SetMetricsPrinting(bool print)
+{
+    m_print_metrics = print;
+}
+
+void
+RouteService::RecordMetrics(const RouteMetrics& metrics)
+{
+    {
+        std::lock_guard lock(m_metrics_mutex);
+
+        m_metrics[m_metrics_count % kMetricsHistory] = metrics;
+        m_metrics_count++;
+    }
+
+    if (m_print_metrics)
+    {
+        printf("Route %u at %u%%: %u ms, %u nodes expanded, %u partial paths, open set %u, "
+               "%u/%u nodes, %u points\n",
+               static_cast<unsigned>(metrics.request),
+               metrics.heuristic_weight,
+               static_cast<unsigned>(metrics.time.count()),
+               metrics.nodes_expanded,
+               metrics.partial_paths,
+               metrics.open_set_high_water,
+               metrics.nodes_used,
+               static_cast<unsigned>(kTargetCacheSize),
+               metrics.points);
+    }
+}
+
+bool
+RouteService::IsIdle()
+{
+    std::lock_guard lock(m_job_mutex);
+
+    return m_requests.empty() && m_jobs.empty() && m_running_jobs == 0;
+}
+
+void
+RouteService::Publish(uint32_t request,
+                      IRouteListener::EventType type,
+                      std::span<const IndexType> route)
+{
+    std::lock_guard lock(m_publish_mutex);
+
+    if (request != kNoRequest)
+    {
+        if (request < m_newest_request)
+        {
+            // Superseded by a newer request, e.g., from a job which was already running
+            return;
+        }
+        m_newest_request = request;
+    }
+
+    if (type == IRouteListener::EventType::kIntermediate)
+    {
+        if (std::ranges::find(m_finished_requests, request) != m_finished_requests.end())
+        {
+            // The cheapest route is already out
+            return;
+        }
+
+        if (request == m_last_published_request &&
+            std::ranges::equal(route, m_last_published.Span()))
+        {
+            // No better than the last one
+            return;
+        }
+    }
+
+    RouteBuffer buffer;
+
+    if (type != IRouteListener::EventType::kCalculating)
+    {
+        // The one copy, shared by all listeners
+        buffer = m_route_arena.Allocate(route);
+        m_last_published = buffer;
+        m_last_published_request = request;
+    }
+
+    if (type == IRouteListener::EventType::kReady)
+    {
+        m_route = buffer;
+
+        if (request != kNoRequest)
+        {
+            m_finished_requests[m_next_finished] = request;
+            m_next_finished = (m_next_finished + 1) % m_finished_requests.size();
+        }
+    }
+
+    // The listener queues are single producer
+    for (auto listener : m_listeners)
+    {
+        listener->PushEvent(type, request, buffer);
+    }
+}
+
+bool
+RouteService::FollowPosition(IndexType position)
+{
+    RouteBuffer buffer;
+
+    {
+        std::lock_guard lock(m_publish_mutex);
+        buffer = m_route;
+    }
+
+    const auto route = buffer.Span();
+    if (route.empty())
+    {
+        return false;
+    }
+
+    if (m_router->DistanceToRoute(position, route.last(1)) <= kOffRouteDistance)
+    {
+        // Arrived, so nothing more to follow
+        std::lock_guard lock(m_publish_mutex);
+        m_route = {};
+        return false;
+    }
+
+    if (m_router->DistanceToRoute(position, route) <= kOffRouteDistance)
+    {
+        return false;
+    }
+
+    // Only the part of the route close to the boat is searched, so the old route stays shown
+    if (auto repaired = m_router->RepairRoute(position, route); !repaired.empty())
+    {
+        Publish(kNoRequest, IRouteListener::EventType::kReady, repaired);
+        return false;
+    }
+
+    // Too far off, so a new route as for a request. The old one is shown until it's ready
+    uint32_t request;
+    {
+        std::lock_guard lock(m_job_mutex);
+        request = m_next_request++;
+    }
+    QueueJobs(request, position, route.back());
+    for (auto& worker : m_workers)
+    {
+        worker->Awake();
+    }
+
+    return true;
+}
+
+std::vector<IndexType>
+RouteService::CachedDestinations() const
+{
+    std::vector<IndexType> out;
+    auto state = m_application_state.CheckoutReadonly();
+
+    // 0 when not set
+    if (state->home_position != 0)
+    {
+        out.push_back(state->home_position);
+    }
+    std::ranges::copy(state->stored_positions, std::back_inserter(out));
+
+    return out;
+}
+
+bool
+RouteService::QueueCachedRoutesUpdate(IndexType position)
+{
+    const auto destinations = CachedDestinations();
+    std::lock_guard lock(m_job_mutex);
+
+    // Checked again when it's done
+    if (m_updating_cached_routes)
+    {
+        return false;
+    }
+    if (m_cache_origin && destinations == m_cached_destinations &&
+        m_router->DistanceToRoute(position, std::span(&*m_cache_origin, 1)) <= kRecacheDistance)
+    {
+        return false;
+    }
+
+    // Replaces a queued one, only the latest position matters
+    m_cached_routes_position = position;
+    if (!m_workers.empty())
+    {
+        m_workers.front()->Awake();
+    }
+
+    return true;
+}
+
+void
+RouteService::UpdateCachedRoutes(Router<kTargetCacheSize>& router, IndexType position)
+{
+    auto destinations = CachedDestinations();
+
+    // One search for all of them
+    auto routes = router.CalculateRoutes(position, destinations);
+
+    std::lock_guard lock(m_job_mutex);
+    m_cached_routes = std::move(routes);
+    m_cached_destinations = std::move(destinations);
+    m_cache_origin = position;
+    m_updating_cached_routes = false;
+}
+
+std::span<const IndexType>
+RouteService::CachedRoute(IndexType from, IndexType to)
+{
+    std::vector<IndexType> route;
+
+    {
+        // Copied, since they can be updated by a worker meanwhile
+        std::lock_guard lock(m_job_mutex);
+
+        for (auto i = 0u; i < m_cached_destinations.size(); i++)
+        {
+            if (m_cached_destinations[i] == to && !m_cached_routes[i].empty())
+            {
+                route = m_cached_routes[i];
+                break;
+            }
+        }
+    }
+
+    // The start can be far from where the routes were calculated (e.g., the demo boat), and is
+    // then left to a job
+    if (route.empty() || m_router->DistanceToRoute(from, route) > kMaxRepairDistance)
+    {
+        return {};
+    }
+
+    // The boat has moved a bit since, so lead it onto the cached route. Empty if that fails
+    return m_router->RepairRoute(from, route);
+}
+
+std::vector<IndexType>
+RouteService::RecentRoute(IndexType from, IndexType to)
+{
+    std::vector<IndexType> cached;
+
+    {
+        std::lock_guard lock(m_job_mutex);
+
+        auto route = m_route_cache.Lookup(from, to);
+        cached.assign(route.begin(), route.end());
+    }
+
+    // Only local searches, so a miss (queued as a job) when too far from it
+    if (cached.empty() || m_router->DistanceToRoute(from, cached) > kMaxRepairDistance ||
+        m_router->DistanceToRoute(to, cached) > kMaxRepairDistance)
+    {
+        return {};
+    }
+
+    // Onto the route from the start
+    auto route = m_router->RepairRoute(from, cached);
+    std::vector<IndexType> out(route.begin(), route.end());
+
+    if (!out.empty() && out.back() != to)
+    {
+        // ... and from it to the destination, as the route back from there
+        std::ranges::reverse(out);
+        route = m_router->RepairRoute(to, out);
+        out.assign(route.rbegin(), route.rend());
+    }
+
+    return out;
+}
+
 Point
 RouteService::RandomWaterPoint() const
 {
@@ -108,7 +703,7 @@ RouteService::RandomWaterPoint() const
     {
         p = {static_cast<int32_t>((rand() % m_row_size) * kPathFinderTileSize),
              static_cast<int32_t>((rand() % m_rows) * kPathFinderTileSize)};
-    } while (IsWater(m_land_mask, PointToLandIndex(p, m_row_size)) == false);
+    } while (IsWater(*m_land_mask, PointToLandIndex(p, m_row_size)) == false);
 
     return p;
 }
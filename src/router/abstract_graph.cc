@@ -0,0 +1,322 @@
+#include "abstract_graph.hh"
+
+#include "route_utils.hh"
+#include "router.hh"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <unordered_map>
+
+// Portals are placed with at most this spacing along a cluster border
+constexpr auto kPortalSpacing = 16u;
+constexpr auto kNoCost = std::numeric_limits<CostType>::max();
+
+using BuilderRouter = Router<kMapBuilderCacheSize>;
+
+AbstractGraph::AbstractGraph(std::span<const uint32_t> data)
+{
+    constexpr auto kHeaderWords = sizeof(AbstractGraphHeader) / sizeof(uint32_t);
+
+    if (data.size() < kHeaderWords)
+    {
+        return;
+    }
+
+    auto header = reinterpret_cast<const AbstractGraphHeader*>(data.data());
+    if (header->magic != kAbstractGraphMagic || header->cluster_size == 0)
+    {
+        return;
+    }
+
+    // In 64 bits, so that bogus counts can't wrap around
+    const auto cluster_count = uint64_t {header->cluster_row_size} * header->cluster_rows;
+    const auto expected_words = kHeaderWords + cluster_count + 1 + uint64_t {header->portal_count} +
+                                header->portal_count + 1 + header->edge_count;
+
+    if (data.size() < expected_words)
+    {
+        return;
+    }
+
+    auto p = data.subspan(kHeaderWords);
+
+    m_cluster_portals = p.subspan(0, cluster_count + 1);
+    p = p.subspan(cluster_count + 1);
+    m_portal_indices = p.subspan(0, header->portal_count);
+    p = p.subspan(header->portal_count);
+    m_portal_edges = p.subspan(0, header->portal_count + 1);
+    p = p.subspan(header->portal_count + 1);
+    m_edges = {reinterpret_cast<const AbstractEdge*>(p.data()), header->edge_count};
+
+    // Don't trust the ranges and the portal numbers blindly either
+    auto is_range_table = [](auto table, uint32_t last) {
+        return table.front() == 0 && table.back() == last && std::ranges::is_sorted(table);
+    };
+    const auto portal_count = header->portal_count;
+
+    if (!is_range_table(m_cluster_portals, portal_count) ||
+        !is_range_table(m_portal_edges, header->edge_count) ||
+        !std::ranges::all_of(m_edges,
+                             [portal_count](const auto& edge) { return edge.to < portal_count; }))
+    {
+        m_cluster_portals = {};
+        m_portal_indices = {};
+        m_portal_edges = {};
+        m_edges = {};
+        return;
+    }
+
+    m_header = header;
+}
+
+bool
+AbstractGraph::Matches(unsigned land_mask_width, unsigned land_mask_height) const
+{
+    if (!IsValid())
+    {
+        return false;
+    }
+
+    const auto cluster_size = m_header->cluster_size;
+    const auto size = static_cast<uint64_t>(land_mask_width) * land_mask_height;
+
+    if (m_header->cluster_row_size != (land_mask_width + cluster_size - 1) / cluster_size ||
+        m_header->cluster_rows != (land_mask_height + cluster_size - 1) / cluster_size)
+    {
+        return false;
+    }
+
+    // Each portal in the land mask, and in the cluster it is listed for
+    for (auto cluster = 0u; cluster + 1 < m_cluster_portals.size(); cluster++)
+    {
+        for (auto portal = m_cluster_portals[cluster]; portal < m_cluster_portals[cluster + 1];
+             portal++)
+        {
+            const auto index = m_portal_indices[portal];
+
+            if (index >= size || ClusterOf(index, land_mask_width) != cluster)
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool
+AbstractGraph::IsValid() const
+{
+    return m_header != nullptr;
+}
+
+unsigned
+AbstractGraph::ClusterSize() const
+{
+    return m_header->cluster_size;
+}
+
+unsigned
+AbstractGraph::PortalCount() const
+{
+    return m_header->portal_count;
+}
+
+unsigned
+AbstractGraph::ClusterOf(IndexType index, unsigned land_mask_row_size) const
+{
+    const auto x = index % land_mask_row_size;
+    const auto y = index / land_mask_row_size;
+
+    return (y / m_header->cluster_size) * m_header->cluster_row_size + x / m_header->cluster_size;
+}
+
+std::pair<uint32_t, uint32_t>
+AbstractGraph::PortalRange(unsigned cluster) const
+{
+    return {m_cluster_portals[cluster], m_cluster_portals[cluster + 1]};
+}
+
+IndexType
+AbstractGraph::PortalIndex(uint32_t portal) const
+{
+    return m_portal_indices[portal];
+}
+
+std::span<const AbstractEdge>
+AbstractGraph::Edges(uint32_t portal) const
+{
+    return m_edges.subspan(m_portal_edges[portal], m_portal_edges[portal + 1] - m_portal_edges[portal]);
+}
+
+std::vector<uint32_t>
+BuildAbstractGraph(const LandMask& land_mask, unsigned cluster_size)
+{
+    // For the step costs, so that the edges cost what the router's searches would
+    const BuilderRouter router(land_mask);
+    const auto width = land_mask.Width();
+    const auto height = land_mask.Height();
+
+    const auto cluster_row_size = (width + cluster_size - 1) / cluster_size;
+    const auto cluster_rows = (height + cluster_size - 1) / cluster_size;
+    const auto cluster_count = cluster_row_size * cluster_rows;
+
+    auto cluster_of = [=](IndexType index) {
+        return (index / width / cluster_size) * cluster_row_size + index % width / cluster_size;
+    };
+    auto local_index = [=](IndexType index) {
+        return (index / width % cluster_size) * cluster_size + index % width % cluster_size;
+    };
+
+    // Portal cells per cluster, and the portal pairs across the cluster borders
+    std::vector<std::vector<IndexType>> cluster_portals(cluster_count);
+    std::vector<std::pair<IndexType, IndexType>> crossings;
+
+    auto add_portal = [&](IndexType index) {
+        auto& portals = cluster_portals[cluster_of(index)];
+
+        if (std::ranges::find(portals, index) == portals.end())
+        {
+            portals.push_back(index);
+        }
+    };
+
+    // Find the water passages along a border. side(i, n) is the cell at position i on side n
+    auto add_entrances = [&](unsigned length, auto side) {
+        auto run_start = 0u;
+        auto in_run = false;
+
+        for (auto i = 0u; i <= length; i++)
+        {
+            const auto passable = i < length && router.IsWaterAt(side(i, 0).x, side(i, 0).y) &&
+                                  router.IsWaterAt(side(i, 1).x, side(i, 1).y);
+
+            if (in_run && (!passable || i % cluster_size == 0))
+            {
+                // Place the portals in the middle of equal parts of the passage
+                const auto run_length = i - run_start;
+                const auto portal_count = (run_length + kPortalSpacing - 1) / kPortalSpacing;
+
+                for (auto n = 0u; n < portal_count; n++)
+                {
+                    const auto position = run_start + (2 * n + 1) * run_length / (2 * portal_count);
+                    const auto a = side(position, 0);
+                    const auto b = side(position, 1);
+                    const auto a_index = static_cast<IndexType>(a.y * width + a.x);
+                    const auto b_index = static_cast<IndexType>(b.y * width + b.x);
+
+                    add_portal(a_index);
+                    add_portal(b_index);
+                    crossings.push_back({a_index, b_index});
+                    crossings.push_back({b_index, a_index});
+                }
+                in_run = false;
+            }
+            if (passable && !in_run)
+            {
+                run_start = i;
+                in_run = true;
+            }
+        }
+    };
+
+    for (auto x = cluster_size; x < width; x += cluster_size)
+    {
+        add_entrances(height, [x](unsigned i, unsigned n) {
+            return Point {static_cast<int32_t>(x - 1 + n), static_cast<int32_t>(i)};
+        });
+    }
+    for (auto y = cluster_size; y < height; y += cluster_size)
+    {
+        add_entrances(width, [y](unsigned i, unsigned n) {
+            return Point {static_cast<int32_t>(i), static_cast<int32_t>(y - 1 + n)};
+        });
+    }
+
+    // Number the portals cluster by cluster
+    std::vector<uint32_t> first_portal;
+    std::vector<uint32_t> portal_indices;
+    std::unordered_map<IndexType, uint32_t> portal_numbers;
+
+    for (const auto& portals : cluster_portals)
+    {
+        first_portal.push_back(portal_indices.size());
+        for (auto index : portals)
+        {
+            portal_numbers[index] = portal_indices.size();
+            portal_indices.push_back(index);
+        }
+    }
+    first_portal.push_back(portal_indices.size());
+
+    if (portal_indices.size() > std::numeric_limits<uint16_t>::max())
+    {
+        // Doesn't fit the edge format
+        return {};
+    }
+
+    std::ranges::sort(crossings);
+
+    // The edges: within the cluster, and across the border
+    std::vector<uint32_t> first_edge;
+    std::vector<uint32_t> edges;
+    std::vector<CostType> costs;
+
+    auto add_edge = [&edges](uint32_t to, CostType cost) {
+        const auto clamped = std::min<CostType>(cost, std::numeric_limits<uint16_t>::max());
+
+        edges.push_back(std::bit_cast<uint32_t>(
+            AbstractEdge {static_cast<uint16_t>(to), static_cast<uint16_t>(clamped)}));
+    };
+
+    for (const auto& portals : cluster_portals)
+    {
+        for (auto from : portals)
+        {
+            first_edge.push_back(edges.size());
+
+            router.ClusterDijkstra(from, cluster_size, false, costs);
+            for (auto to : portals)
+            {
+                const auto cost = costs[local_index(to)];
+
+                if (to != from && cost != kNoCost)
+                {
+                    add_edge(portal_numbers[to], cost);
+                }
+            }
+
+            auto [first, last] = std::ranges::equal_range(
+                crossings, from, {}, &std::pair<IndexType, IndexType>::first);
+            for (auto it = first; it != last; ++it)
+            {
+                const auto direction = IndexPairToDirection(from, it->second, width);
+
+                add_edge(portal_numbers[it->second],
+                         router.StepCost(it->second, direction, Vector::Standstill()));
+            }
+        }
+    }
+    first_edge.push_back(edges.size());
+
+    const auto header = AbstractGraphHeader {
+        kAbstractGraphMagic,
+        cluster_size,
+        cluster_row_size,
+        cluster_rows,
+        static_cast<uint32_t>(portal_indices.size()),
+        static_cast<uint32_t>(edges.size()),
+    };
+    const auto header_words =
+        std::bit_cast<std::array<uint32_t, sizeof(AbstractGraphHeader) / sizeof(uint32_t)>>(
+            header);
+
+    std::vector<uint32_t> out(header_words.begin(), header_words.end());
+    out.insert(out.end(), first_portal.begin(), first_portal.end());
+    out.insert(out.end(), portal_indices.begin(), portal_indices.end());
+    out.insert(out.end(), first_edge.begin(), first_edge.end());
+    out.insert(out.end(), edges.begin(), edges.end());
+
+    return out;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "land_mask.hh"
+#include "tile.hh"
+
+#include <span>
+#include <utility>
+#include <vector>
+
+// ABSG
+constexpr uint32_t kAbstractGraphMagic = 0x47534241;
+
+// Clusters of kClusterSize x kClusterSize land mask cells
+constexpr auto kClusterSize = 32;
+
+/*
+ * The abstract (HPA*) graph, as stored in map.bin. The land mask is divided into clusters, and
+ * each water passage between two neighboring clusters gets one or more portal cells on each side.
+ * The edges connect the portals within a cluster (with the cost of the best path between them,
+ * inside the cluster), and the portal pairs across the cluster borders.
+ *
+ * Layout, all uint32_t:
+ *
+ *   AbstractGraphHeader
+ *   first portal per cluster[cluster_row_size * cluster_rows + 1]
+ *   portal land mask index[portal_count]
+ *   first edge per portal[portal_count + 1]
+ *   AbstractEdge[edge_count]
+ */
+struct AbstractGraphHeader
+{
+    uint32_t magic;
+    uint32_t cluster_size;
+    uint32_t cluster_row_size;
+    uint32_t cluster_rows;
+    uint32_t portal_count;
+    uint32_t edge_count;
+};
+static_assert(sizeof(AbstractGraphHeader) == 24);
+
+struct AbstractEdge
+{
+    uint16_t to;
+    uint16_t cost;
+};
+static_assert(sizeof(AbstractEdge) == 4);
+
+
+class AbstractGraph
+{
+public:
+    // A view of the serialized graph (in flash or in RAM), which must outlive this object
+    explicit AbstractGraph(std::span<const uint32_t> data);
+
+    bool IsValid() const;
+
+    // Valid, and built for a land mask of this size
+    bool Matches(unsigned land_mask_width, unsigned land_mask_height) const;
+
+    unsigned ClusterSize() const;
+
+    unsigned PortalCount() const;
+
+    unsigned ClusterOf(IndexType index, unsigned land_mask_row_size) const;
+
+    // The [first, last) portal numbers of a cluster
+    std::pair<uint32_t, uint32_t> PortalRange(unsigned cluster) const;
+
+    IndexType PortalIndex(uint32_t portal) const;
+
+    std::span<const AbstractEdge> Edges(uint32_t portal) const;
+
+private:
+    const AbstractGraphHeader* m_header {nullptr};
+    std::span<const uint32_t> m_cluster_portals;
+    std::span<const uint32_t> m_portal_indices;
+    std::span<const uint32_t> m_portal_edges;
+    std::span<const AbstractEdge> m_edges;
+};
+
+// Build the serialized graph for a land mask (at map build time), with the step costs of the router
+std::vector<uint32_t> BuildAbstractGraph(const LandMask& land_mask,
+                                         unsigned cluster_size = kClusterSize);
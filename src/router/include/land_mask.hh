@@ -0,0 +1,121 @@
+#pragma once
+
+#include "tile.hh"
+
+#include <span>
+#include <vector>
+
+// BLMK
+constexpr uint32_t kBlockLandMaskMagic = 0x4b4d4c42;
+
+// Blocks of kLandMaskBlockSize x kLandMaskBlockSize cells, one uint32_t per block row
+constexpr auto kLandMaskBlockSize = 32;
+
+// Block table entries (others are the word offset of the block bitmap)
+constexpr uint32_t kAllWaterBlock = 0;
+constexpr uint32_t kAllLandBlock = 1;
+
+/*
+ * The block-sparse land mask, as stored in map.bin. Blocks which are all land or all water are
+ * only flags in the block table, and the mixed ones are bitmaps. Open sea and inland areas then
+ * take almost no space.
+ *
+ * Layout, all uint32_t:
+ *
+ *   BlockLandMaskHeader
+ *   block table[block_row_size * block_rows]: kAllWaterBlock, kAllLandBlock or the offset (in
+ *       words, from the header) of the block bitmap
+ *   bitmaps[bitmap_count]: 32 rows of 32 bits each (set for land, bit 0 is the leftmost cell)
+ */
+struct BlockLandMaskHeader
+{
+    uint32_t magic;
+    uint32_t width;
+    uint32_t height;
+    uint32_t block_row_size;
+    uint32_t block_rows;
+    uint32_t bitmap_count;
+};
+static_assert(sizeof(BlockLandMaskHeader) == 24);
+
+
+// Read-only access to the land mask, either the plain bitmap or the block-sparse one
+class LandMask
+{
+public:
+    // A plain bitmap, one bit per cell (set for land), with the rows after each other
+    LandMask(std::span<const uint32_t> bitmap, unsigned width, unsigned height);
+
+    // The serialized block-sparse mask (in flash or in RAM), which must outlive this object
+    explicit LandMask(std::span<const uint32_t> blocks);
+
+    bool IsValid() const
+    {
+        return m_width != 0;
+    }
+
+    unsigned Width() const
+    {
+        return m_width;
+    }
+
+    unsigned Height() const
+    {
+        return m_height;
+    }
+
+    // Outside the mask counts as land
+    bool IsWater(IndexType index) const
+    {
+        if (index >= m_size)
+        {
+            return false;
+        }
+        if (m_blocks.empty())
+        {
+            return (m_bitmap[index / 32] & (1u << (index % 32))) == 0;
+        }
+
+        const auto x = index % m_width;
+
+        return (BlockRow(x / kLandMaskBlockSize, index / m_width) & (1u << (x % 32))) == 0;
+    }
+
+    // The land bits of the 32 cells from x,y (inside the mask) onwards. Bits past the end of the
+    // row are undefined
+    uint32_t RowBits(unsigned x, unsigned y) const;
+
+    // The size in bytes of the data behind the mask
+    size_t DataSize() const;
+
+private:
+    uint32_t BlockRow(unsigned block_x, unsigned y) const
+    {
+        const auto entry = m_blocks[(y / kLandMaskBlockSize) * m_block_row_size + block_x];
+
+        if (entry == kAllWaterBlock)
+        {
+            return 0;
+        }
+        if (entry == kAllLandBlock)
+        {
+            return 0xffffffff;
+        }
+
+        return m_data[entry + y % kLandMaskBlockSize];
+    }
+
+    // Either the plain bitmap, or m_data and m_blocks for the block-sparse one
+    std::span<const uint32_t> m_bitmap;
+    std::span<const uint32_t> m_data;
+    std::span<const uint32_t> m_blocks;
+    unsigned m_block_row_size {0};
+    unsigned m_width {0};
+    unsigned m_height {0};
+    unsigned m_size {0};
+};
+
+// Build the serialized block-sparse mask from a plain bitmap (at map build time, and for tests)
+std::vector<uint32_t> BuildBlockLandMask(std::span<const uint32_t> bitmap,
+                                         unsigned width,
+                                         unsigned height);
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "land_mask.hh"
+#include "tile.hh"
+
+#include <span>
+#include <vector>
+
+// LMRK
+constexpr uint32_t kLandmarksMagic = 0x4b524d4c;
+
+// Blocks of kLandmarkBlockSize x kLandmarkBlockSize land mask cells
+constexpr auto kLandmarkBlockSize = 4;
+constexpr auto kLandmarkCount = 4;
+constexpr auto kMaxLandmarks = 16;
+
+// For blocks without a (known) distance from a landmark
+constexpr uint16_t kUnknownLandmarkDistance = 0xffff;
+
+/*
+ * Landmark distance tables for the ALT (A*, Landmarks, Triangle inequality) heuristic, as stored
+ * in map.bin. The distances are the shortest path costs from each landmark, with a lower bound of
+ * the step costs. To keep the tables small, only the lowest and highest distance within each block
+ * of cells is stored.
+ *
+ * Layout, all uint32_t:
+ *
+ *   LandmarksHeader
+ *   landmark land mask index[landmark_count]
+ *   per landmark: lowest | highest << 16, per block[block_row_size * block_rows]
+ */
+struct LandmarksHeader
+{
+    uint32_t magic;
+    uint32_t block_size;
+    uint32_t block_row_size;
+    uint32_t block_rows;
+    uint32_t landmark_count;
+};
+static_assert(sizeof(LandmarksHeader) == 20);
+
+struct LandmarkDistance
+{
+    uint16_t lowest;
+    uint16_t highest;
+};
+static_assert(sizeof(LandmarkDistance) == 4);
+
+
+class Landmarks
+{
+public:
+    // A view of the serialized tables (in flash or in RAM), which must outlive this object
+    explicit Landmarks(std::span<const uint32_t> data);
+
+    bool IsValid() const;
+
+    // Valid, and built for a land mask of this size
+    bool Matches(unsigned land_mask_width, unsigned land_mask_height) const;
+
+    unsigned Count() const;
+
+    IndexType LandmarkIndex(unsigned landmark) const;
+
+    // The distance range from a landmark to the block a cell is in
+    LandmarkDistance Distance(unsigned landmark, IndexType index, unsigned land_mask_row_size) const;
+
+private:
+    const LandmarksHeader* m_header {nullptr};
+    std::span<const uint32_t> m_landmark_indices;
+    std::span<const LandmarkDistance> m_distances;
+};
+
+// Build the serialized landmark tables for a land mask (at map build time)
+std::vector<uint32_t> BuildLandmarks(const LandMask& land_mask,
+                                     unsigned count = kLandmarkCount,
+                                     unsigned block_size = kLandmarkBlockSize);
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <etl/priority_queue.h>
+#include <etl/vector.h>
+
+/*
+ * Open set policies for the router A*. T is a node pointer, with an f (cost) member and IsOpen().
+ * Pop() returns nullptr when the set is empty. HighWater() is the most entries held since
+ * ResetHighWater(), over Clear() calls, and EntrySize() the bytes for each.
+ */
+
+// Binary heap, ordered on f
+template <typename T, size_t SIZE>
+class BinaryHeapOpenSet
+{
+public:
+    void Clear()
+    {
+        m_queue.clear();
+    }
+
+    void Push(T node)
+    {
+        m_queue.push(node);
+        m_high_water = std::max(m_high_water, m_queue.size());
+    }
+
+    // f is lowered in place, and the node keeps its position in the heap
+    void Decrease(T)
+    {
+    }
+
+    T Pop()
+    {
+        if (m_queue.empty())
+        {
+            return nullptr;
+        }
+
+        auto node = m_queue.top();
+        m_queue.pop();
+
+        return node;
+    }
+
+    size_t HighWater() const
+    {
+        return m_high_water;
+    }
+
+    void ResetHighWater()
+    {
+        m_high_water = 0;
+    }
+
+    static constexpr size_t EntrySize()
+    {
+        return sizeof(T);
+    }
+
+private:
+    struct CompareNodePointers
+    {
+        bool operator()(const T lhs, const T rhs) const
+        {
+            return lhs->f > rhs->f;
+        }
+    };
+
+    etl::priority_queue<T, SIZE, etl::vector<T, SIZE>, CompareNodePointers> m_queue;
+    size_t m_high_water {0};
+};
+
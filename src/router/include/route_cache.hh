@@ -0,0 +1,64 @@
+#pragma once
+
+#include "tile.hh"
+
+#include <span>
+#include <vector>
+
+// Start and destination cells are snapped to squares of this many land mask cells
+constexpr auto kRouteCacheCellSize = 8;
+constexpr size_t kDefaultRouteCacheBudget = 64 * 1024;
+
+// Recently calculated routes, keyed on the squares of their start and destination, with the least
+// recently used ones evicted to stay within a memory budget
+class RouteCache
+{
+public:
+    explicit RouteCache(unsigned land_mask_row_size,
+                        size_t budget = kDefaultRouteCacheBudget,
+                        unsigned cell_size = kRouteCacheCellSize);
+
+    // In bytes, evicting routes if needed. 0 turns the cache off
+    void SetBudget(size_t budget);
+
+    // A route from close to from to close to to (or empty). Valid until the next Insert()
+    std::span<const IndexType> Lookup(IndexType from, IndexType to);
+
+    // Replaces the route for the same squares, if any
+    void Insert(IndexType from, IndexType to, std::span<const IndexType> route);
+
+    void Clear();
+
+    unsigned Count() const
+    {
+        return m_entries.size();
+    }
+
+    // The bytes used by the cached routes
+    size_t Size() const
+    {
+        return m_size;
+    }
+
+private:
+    struct Entry
+    {
+        uint32_t from_square;
+        uint32_t to_square;
+        std::vector<IndexType> route;
+    };
+
+    uint32_t Square(IndexType index) const;
+
+    static size_t EntrySize(size_t route_size);
+
+    void Evict(size_t budget);
+
+    const unsigned m_row_size;
+    const unsigned m_cell_size;
+    size_t m_budget;
+    size_t m_size {0};
+
+    // The most recently used first
+    std::vector<Entry> m_entries;
+};
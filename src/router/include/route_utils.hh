@@ -26,6 +26,12 @@ IsWater(std::span<const uint32_t> land_mask, IndexType index)
     return (land_mask[index / 32] & (1 << (index % 32))) == 0;
 }
 
+static bool
+IsWater(const LandMask& land_mask, IndexType index)
+{
+    return land_mask.IsWater(index);
+}
+
 static Vector
 IndexPairToDirection(IndexType from, IndexType to, unsigned row_size)
 {
@@ -1,49 +1,157 @@
 #pragma once
 
+#include "abstract_graph.hh"
+#include "land_mask.hh"
+#include "landmarks.hh"
+#include "open_set.hh"
 #include "tile.hh"
 
-#include <etl/priority_queue.h>
-#include <etl/unordered_map.h>
 #include <etl/vector.h>
+#include <functional>
+#include <memory>
+#include <optional>
 #include <queue>
 #include <span>
 
-constexpr auto kTargetCacheSize = 65535;
+// Bounded by the PSRAM budget (doc/ram.md). Searches which need more nodes continue from the best
+// partial path, which gets costlier routes and more failed searches the smaller the cache is
+constexpr auto kTargetCacheSize = 49152;
 constexpr auto kUnitTestCacheSize = 24;
+// Too small for the first expansions of a bidirectional search
+constexpr auto kUnitTestTinyCacheSize = 12;
+// The map builders only use the step costs, not the node cache
+constexpr auto kMapBuilderCacheSize = 1;
 constexpr IndexType kInvalidIndex = std::numeric_limits<IndexType>::max();
+// Routes are only repaired (with a local search) from this close to them, in cells
+constexpr auto kMaxRepairDistance = 64u;
+// Nodes taken from the open set between the checks of SetTimeLimit()
+constexpr auto kTimeLimitCheckInterval = 64u;
 
-template <size_t CACHE_SIZE>
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET = BinaryHeapOpenSet>
 class Router
 {
     static_assert(CACHE_SIZE <= std::numeric_limits<uint16_t>::max());
 
 public:
+    enum class Engine : uint8_t
+    {
+        // Plain A*, one cell at a time
+        kAstar,
+        // Jump Point Search, which skips over open water
+        kJumpPointSearch,
+        // A* from both ends, one cell at a time, sharing the node cache
+        kBidirectional,
+    };
+
     struct Stats
     {
         void Reset()
         {
             partial_paths = 0;
             nodes_expanded = 0;
+            cells_scanned = 0;
+            abstract_nodes_expanded = 0;
+            landmarks = 0;
+            open_set_high_water = 0;
+            nodes_used = 0;
+            expansion_limit_reached = false;
+            meeting_unproven = false;
         }
 
         unsigned partial_paths {0};
         unsigned nodes_expanded {0};
+        // Cells checked one by one while jumping (JPS only)
+        unsigned cells_scanned {0};
+        // Portals expanded in the abstract graph
+        unsigned abstract_nodes_expanded {0};
+        // Landmarks used by the heuristic (ALT)
+        unsigned landmarks {0};
+        // The most open set entries and node cache entries held by a search (of CACHE_SIZE)
+        unsigned open_set_high_water {0};
+        unsigned nodes_used {0};
+        // The search gave up at the SetExpansionLimit() or SetTimeLimit() limit
+        bool expansion_limit_reached {false};
+        // The bidirectional search ran out of nodes after the frontiers met, and returned the
+        // cheapest meeting so far, which might not be the cheapest route
+        bool meeting_unproven {false};
     };
 
-    Router(std::span<const uint32_t> land_mask, unsigned height, unsigned width);
+    Router(std::span<const uint32_t> land_mask,
+           unsigned height,
+           unsigned width,
+           Engine engine = Engine::kAstar);
+
+    // The data behind the land mask must outlive the router
+    explicit Router(const LandMask& land_mask, Engine engine = Engine::kAstar);
+
+    void SetEngine(Engine engine);
+
+    // Straighten the routes where there is line of sight, so that they are not limited to the 8
+    // directions. Off by default
+    void SetSmoothing(bool smoothing);
+
+    // Weighted A*: inflate the heuristic for quicker searches, with routes costing at most
+    // percent / 100 times the cheapest. 100 (the default) gives the cheapest routes
+    void SetHeuristicWeight(unsigned percent);
+
+    // Give up (with an empty route) after this many node expansions, to bound the time a search
+    // takes. 0 (the default) for no limit
+    void SetExpansionLimit(unsigned expansions);
+
+    // As the expansion limit, but give up when time_up returns true. It is asked every
+    // kTimeLimitCheckInterval nodes, so that it can read a clock. Empty (the default) for no limit
+    void SetTimeLimit(std::function<bool()> time_up);
+
+    // Search the abstract graph first for routes between clusters. The graph must outlive the
+    // router, and is ignored if it is invalid or was built for another land mask
+    void SetAbstractGraph(const AbstractGraph* graph);
+
+    // Tighten the heuristic with landmark distances (ALT), to expand fewer nodes. The tables must
+    // outlive the router
+    void SetLandmarks(const Landmarks* landmarks);
 
     std::span<const IndexType> CalculateRoute(Point from, Point to);
     std::span<const IndexType> CalculateRoute(IndexType from, IndexType to);
 
-    // For unit tests
+    // Lead back to a route (as returned by CalculateRoute) from a point off it, with a local search
+    // to rejoin it a bit ahead. Empty when further away than kMaxRepairDistance or when the local
+    // search fails, and a full search is then up to the caller
+    std::span<const IndexType> RepairRoute(IndexType from, std::span<const IndexType> route);
+
+    // Routes from one point to several destinations, with a single search. Destinations which
+    // can't be reached within the node cache get empty routes
+    std::vector<std::vector<IndexType>> CalculateRoutes(IndexType from,
+                                                        std::span<const IndexType> destinations);
+
+    // The distance (in cells) from a point to the closest cell on a route
+    unsigned DistanceToRoute(IndexType index, std::span<const IndexType> route) const;
+
+    // The search cost of following a route cell by cell, to compare routes
+    CostType RouteCost(std::span<const IndexType> route) const;
+
+    // Of the last CalculateRoute(s) or RepairRoute call
     Stats GetStats() const;
 
+    // The bytes of node cache and open set entries the last search used (from GetStats())
+    size_t SearchMemory() const;
+
+    // The heuristic the engine searches with, to tell apart in engine comparisons. The
+    // bidirectional engine uses tighter step costs, which the others were tuned without
+    const char* HeuristicName() const;
+
 private:
+    // The map builders (next to the readers of their tables) use the step costs of the router
+    friend std::vector<uint32_t> BuildAbstractGraph(const LandMask& land_mask,
+                                                    unsigned cluster_size);
+    friend std::vector<uint32_t>
+    BuildLandmarks(const LandMask& land_mask, unsigned count, unsigned block_size);
+
     enum class AstarResult
     {
         kPathFound,
         kNoPath,
         kMaxNodesReached,
+        kExpansionLimitReached,
     };
 
     enum class NodeState : uint8_t
@@ -96,35 +204,195 @@ private:
         NodeState state;
     };
 
-    struct CompareNodePointers
+    // A square of land mask cells, each pointing to its node in m_nodes (stamped with the search
+    // generation, so that old entries are ignored without clearing them)
+    struct NodePage
     {
-        bool operator()(const Node* lhs, const Node* rhs) const
-        {
-            return lhs->f > rhs->f;
-        }
+        std::unique_ptr<uint32_t[]> slots;
+        uint32_t position;
+        uint16_t generation;
+    };
+
+    // A cell on a route, on the line from route[segment] to route[segment + 1]
+    struct RoutePosition
+    {
+        unsigned segment;
+        IndexType index;
+        unsigned distance;
+    };
+
+    // A run of water cells in a row, up to last_x (the runs of a row are sorted)
+    struct WaterRun
+    {
+        uint16_t last_x;
+        uint16_t component;
+    };
+
+    // Components are not labelled beyond this, and such cells are taken as reachable from all
+    static constexpr uint16_t kUnknownComponent = 0xffff;
+
+    // A node reachable from the current one, and the cost to get there
+    struct Successor
+    {
+        IndexType index;
+        CostType cost;
     };
 
     AstarResult RunAstar(IndexType from, IndexType to);
 
-    Node* GetNode(IndexType index);
+    // A* (or JPS) from one end only
+    AstarResult RunForwardAstar(IndexType from, IndexType to);
+
+    AstarResult RunBidirectionalAstar(IndexType from, IndexType to);
+
+    // Or the time limit. Also flags it in the stats
+    bool ExpansionLimitReached();
+
+    bool CalculateAbstractRoute(IndexType from, IndexType to);
+
+    void ClusterDijkstra(IndexType from,
+                         unsigned cluster_size,
+                         bool reverse,
+                         std::vector<CostType>& costs) const;
+
+    // Look up the landmark distances of the target, for the heuristic
+    void PrepareLandmarks(IndexType to);
+
+    CostType LandmarkHeuristic(IndexType from) const;
+
+    void ResetStats();
+
+    void AppendCurrentResult();
+
+    std::span<const IndexType> FinishResult();
+
+    void SmoothRoute(std::vector<IndexType>& route) const;
+
+    // The lowest coast distance on the line, not counting from
+    unsigned LineClearance(IndexType from, IndexType to) const;
+
+    // If the cells between from and to (on a line) keep a coast distance of at least clearance
+    bool LineOfSight(IndexType from, IndexType to, unsigned clearance) const;
+
+    // Bresenham, calling visit for every cell after from, up to and including to. Stops when
+    // visit returns false
+    template <typename F>
+    bool WalkLine(IndexType from, IndexType to, F&& visit) const;
+
+    RoutePosition NearestOnRoute(IndexType index, std::span<const IndexType> route) const;
+
+    unsigned CellDistance(IndexType a, IndexType b) const;
+
+    // Backward nodes (bidirectional search) are kept apart from the forward ones
+    Node* GetNode(IndexType index, bool backward = false);
+
+    // Without creating it
+    Node* FindNode(IndexType index, bool backward) const;
+
+    uint32_t* NodeSlot(IndexType index, bool backward);
+
+    uint32_t NodePagePosition(IndexType index, bool backward) const;
+
+    uint16_t AllocateNodePage(uint32_t position);
+
+    void NextGeneration();
 
     etl::vector<IndexType, 8> Neighbors(IndexType index, NeighborType include_neighbors) const;
 
+    // The neighbors of x,y inside the map, as a bit mask (bit i for kNeighborDirections[i])
+    uint8_t InsideAround(int x, int y) const;
+
+    // The same, for the water neighbors only
+    uint8_t WaterAround(int x, int y) const;
+
+    etl::vector<Successor, 8> Successors(const Node* cur, IndexType to, Vector parent_direction);
+
+    etl::vector<Successor, 8>
+    JumpSuccessors(const Node* cur, IndexType to, Vector parent_direction);
+
+    std::optional<Successor> Jump(IndexType from,
+                                  uint16_t open_water,
+                                  Vector direction,
+                                  IndexType to,
+                                  Vector parent_direction);
+
+    bool Reaches(int x, int y, uint16_t open_water, Vector direction, IndexType to);
+
+    bool HasForcedNeighbor(uint16_t open_water, Vector direction) const;
+
+    unsigned StepsTo(int x, int y, Vector direction, IndexType to) const;
+
+    unsigned OpenWaterRun(int x, int y, Vector direction, unsigned max_run) const;
+
+    bool IsWaterAt(int x, int y) const;
+
+    uint16_t OpenWaterAround(int x, int y) const;
+
+    uint32_t LandBits(int x, int y) const;
+
+    CostType BaseCost(Vector direction, Vector parent_direction) const;
+
+    CostType StepCost(IndexType to, Vector direction, Vector parent_direction) const;
+
+    CostType LandPenalty(IndexType index) const;
+
     CostType Heuristic(IndexType from, IndexType to);
 
     void ProduceResult(const Node* cur);
 
-    bool AdjacentToLand(const Node* node) const;
+    void BuildCoastDistance();
 
-    IndexType FindNearestWater(IndexType from) const;
+    unsigned CoastDistance(IndexType index) const;
 
-    const std::span<const uint32_t> m_land_mask;
+    void BuildWaterComponents();
+
+    // The connected body of water a cell belongs to (kUnknownComponent for land)
+    uint16_t WaterComponent(IndexType index) const;
+
+    bool Reachable(IndexType from, IndexType to) const;
+
+    // The closest water cell (by straight distance), optionally only in one body of water. from
+    // itself if there is none
+    IndexType FindNearestWater(IndexType from, uint16_t component = kUnknownComponent) const;
+
+    const LandMask m_land_mask;
     const unsigned m_height;
     const unsigned m_width;
+    Engine m_engine;
+    bool m_smoothing {false};
+    unsigned m_heuristic_weight {100};
+    unsigned m_expansion_limit {0};
+    std::function<bool()> m_time_up;
+    unsigned m_time_limit_countdown {0};
+
+    // Two bits per cell: 0 for land, otherwise the distance to land (capped)
+    std::vector<uint32_t> m_coast_distance;
+
+    // The water runs of all rows, starting at m_water_row_start[row]
+    std::vector<WaterRun> m_water_runs;
+    std::vector<uint32_t> m_water_row_start;
+
+    const AbstractGraph* m_abstract_graph {nullptr};
+
+    const Landmarks* m_landmarks {nullptr};
+    // The landmarks in the same body of water as the target, with the target distances
+    IndexType m_landmark_target {kInvalidIndex};
+    etl::vector<std::pair<unsigned, LandmarkDistance>, kMaxLandmarks> m_target_landmarks;
+    std::vector<CostType> m_abstract_g;
+    std::vector<uint32_t> m_abstract_parent;
+    std::vector<bool> m_abstract_closed;
+
+    OPEN_SET<Node*, CACHE_SIZE> m_open_set;
+    // Only with the bidirectional engine
+    std::unique_ptr<OPEN_SET<Node*, CACHE_SIZE>> m_backward_open_set;
+    etl::vector<Node, CACHE_SIZE> m_nodes;
 
-    etl::priority_queue<Node*, CACHE_SIZE, etl::vector<Node*, CACHE_SIZE>, CompareNodePointers>
-        m_open_set;
-    etl::unordered_map<IndexType, Node, CACHE_SIZE> m_nodes;
+    // Page position -> index in m_node_pages. The second half is for the backward nodes
+    std::vector<uint16_t> m_node_page_table;
+    std::vector<NodePage> m_node_pages;
+    unsigned m_node_page_row_size;
+    unsigned m_next_recycled_page {0};
+    uint16_t m_generation {0};
 
     std::vector<IndexType> m_current_result;
     std::vector<IndexType> m_result;
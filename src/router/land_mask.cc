@@ -0,0 +1,160 @@
+#include "land_mask.hh"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+
+LandMask::LandMask(std::span<const uint32_t> bitmap, unsigned width, unsigned height)
+    : m_bitmap(bitmap)
+    , m_width(width)
+    , m_height(height)
+    , m_size(std::min<size_t>(width * height, bitmap.size() * 32))
+{
+}
+
+LandMask::LandMask(std::span<const uint32_t> blocks)
+{
+    constexpr auto kHeaderWords = sizeof(BlockLandMaskHeader) / sizeof(uint32_t);
+
+    if (blocks.size() < kHeaderWords)
+    {
+        return;
+    }
+
+    auto header = reinterpret_cast<const BlockLandMaskHeader*>(blocks.data());
+
+    // In 64 bits, so that bogus counts can't wrap around
+    const auto block_count = uint64_t {header->block_row_size} * header->block_rows;
+    const auto bitmaps_start = kHeaderWords + block_count;
+    const auto bitmaps_end = bitmaps_start + uint64_t {header->bitmap_count} * kLandMaskBlockSize;
+
+    if (header->magic != kBlockLandMaskMagic ||
+        uint64_t {header->width} * header->height > std::numeric_limits<IndexType>::max() ||
+        uint64_t {header->block_row_size} * kLandMaskBlockSize < header->width ||
+        uint64_t {header->block_rows} * kLandMaskBlockSize < header->height ||
+        blocks.size() < bitmaps_end)
+    {
+        return;
+    }
+
+    m_data = blocks;
+    m_blocks = blocks.subspan(kHeaderWords, block_count);
+
+    // Don't trust the offsets blindly: the bitmaps are after the header and the table
+    if (!std::ranges::all_of(m_blocks, [bitmaps_start, bitmaps_end](auto entry) {
+            return entry == kAllWaterBlock || entry == kAllLandBlock ||
+                   (entry >= bitmaps_start && entry + uint64_t {kLandMaskBlockSize} <= bitmaps_end);
+        }))
+    {
+        m_data = {};
+        m_blocks = {};
+        return;
+    }
+
+    m_block_row_size = header->block_row_size;
+    m_width = header->width;
+    m_height = header->height;
+    m_size = m_width * m_height;
+}
+
+uint32_t
+LandMask::RowBits(unsigned x, unsigned y) const
+{
+    if (m_blocks.empty())
+    {
+        const auto first = y * m_width + x;
+        const auto word = first / 32;
+        const auto bit = first % 32;
+
+        uint64_t bits = m_bitmap[word] >> bit;
+        if (bit != 0 && word + 1 < m_bitmap.size())
+        {
+            bits |= static_cast<uint64_t>(m_bitmap[word + 1]) << (32 - bit);
+        }
+
+        return static_cast<uint32_t>(bits);
+    }
+
+    const auto block_x = x / kLandMaskBlockSize;
+    const auto bit = x % kLandMaskBlockSize;
+
+    uint64_t bits = BlockRow(block_x, y) >> bit;
+    if (bit != 0 && block_x + 1 < m_block_row_size)
+    {
+        bits |= static_cast<uint64_t>(BlockRow(block_x + 1, y)) << (32 - bit);
+    }
+
+    return static_cast<uint32_t>(bits);
+}
+
+size_t
+LandMask::DataSize() const
+{
+    return (m_blocks.empty() ? m_bitmap.size() : m_data.size()) * sizeof(uint32_t);
+}
+
+std::vector<uint32_t>
+BuildBlockLandMask(std::span<const uint32_t> bitmap, unsigned width, unsigned height)
+{
+    constexpr auto kHeaderWords = sizeof(BlockLandMaskHeader) / sizeof(uint32_t);
+
+    const auto plain = LandMask(bitmap, width, height);
+    const auto block_row_size = (width + kLandMaskBlockSize - 1) / kLandMaskBlockSize;
+    const auto block_rows = (height + kLandMaskBlockSize - 1) / kLandMaskBlockSize;
+
+    // The bitmaps come after the header and the table
+    const auto bitmaps_start = kHeaderWords + block_row_size * block_rows;
+    std::vector<uint32_t> table;
+    std::vector<uint32_t> bitmaps;
+
+    for (auto block_y = 0u; block_y < block_rows; block_y++)
+    {
+        for (auto block_x = 0u; block_x < block_row_size; block_x++)
+        {
+            std::array<uint32_t, kLandMaskBlockSize> rows {};
+
+            for (auto row = 0u; row < kLandMaskBlockSize; row++)
+            {
+                const auto y = block_y * kLandMaskBlockSize + row;
+                for (auto column = 0u; column < kLandMaskBlockSize; column++)
+                {
+                    const auto x = block_x * kLandMaskBlockSize + column;
+
+                    // Outside the map is water, as for the plain bitmap padding
+                    if (x < width && y < height && !plain.IsWater(y * width + x))
+                    {
+                        rows[row] |= 1u << column;
+                    }
+                }
+            }
+
+            if (std::ranges::all_of(rows, [](auto r) { return r == 0; }))
+            {
+                table.push_back(kAllWaterBlock);
+            }
+            else if (std::ranges::all_of(rows, [](auto r) { return r == 0xffffffff; }))
+            {
+                table.push_back(kAllLandBlock);
+            }
+            else
+            {
+                table.push_back(bitmaps_start + bitmaps.size());
+                bitmaps.insert(bitmaps.end(), rows.begin(), rows.end());
+            }
+        }
+    }
+
+    std::vector<uint32_t> out(kHeaderWords);
+    auto header = reinterpret_cast<BlockLandMaskHeader*>(out.data());
+    header->magic = kBlockLandMaskMagic;
+    header->width = width;
+    header->height = height;
+    header->block_row_size = block_row_size;
+    header->block_rows = block_rows;
+    header->bitmap_count = bitmaps.size() / kLandMaskBlockSize;
+
+    out.insert(out.end(), table.begin(), table.end());
+    out.insert(out.end(), bitmaps.begin(), bitmaps.end());
+
+    return out;
+}
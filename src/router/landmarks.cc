@@ -0,0 +1,262 @@
+#include "landmarks.hh"
+
+#include "route_utils.hh"
+#include "router.hh"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <queue>
+
+constexpr auto kNoCost = std::numeric_limits<CostType>::max();
+
+using BuilderRouter = Router<kMapBuilderCacheSize>;
+
+Landmarks::Landmarks(std::span<const uint32_t> data)
+{
+    constexpr auto kHeaderWords = sizeof(LandmarksHeader) / sizeof(uint32_t);
+
+    if (data.size() < kHeaderWords)
+    {
+        return;
+    }
+
+    auto header = reinterpret_cast<const LandmarksHeader*>(data.data());
+    if (header->magic != kLandmarksMagic || header->block_size == 0 ||
+        header->landmark_count > kMaxLandmarks)
+    {
+        return;
+    }
+
+    // In 64 bits, so that bogus counts can't wrap around
+    const auto block_count = uint64_t {header->block_row_size} * header->block_rows;
+    const auto expected_words =
+        kHeaderWords + header->landmark_count + header->landmark_count * block_count;
+
+    if (data.size() < expected_words)
+    {
+        return;
+    }
+
+    auto p = data.subspan(kHeaderWords);
+
+    m_landmark_indices = p.subspan(0, header->landmark_count);
+    p = p.subspan(header->landmark_count);
+    m_distances = {reinterpret_cast<const LandmarkDistance*>(p.data()),
+                   header->landmark_count * block_count};
+
+    m_header = header;
+}
+
+bool
+Landmarks::IsValid() const
+{
+    return m_header != nullptr;
+}
+
+bool
+Landmarks::Matches(unsigned land_mask_width, unsigned land_mask_height) const
+{
+    if (!IsValid())
+    {
+        return false;
+    }
+
+    const auto block_size = m_header->block_size;
+    const auto size = static_cast<uint64_t>(land_mask_width) * land_mask_height;
+
+    if (m_header->block_row_size != (land_mask_width + block_size - 1) / block_size ||
+        m_header->block_rows != (land_mask_height + block_size - 1) / block_size)
+    {
+        return false;
+    }
+
+    return std::ranges::all_of(m_landmark_indices, [size](auto index) { return index < size; });
+}
+
+unsigned
+Landmarks::Count() const
+{
+    return m_header->landmark_count;
+}
+
+IndexType
+Landmarks::LandmarkIndex(unsigned landmark) const
+{
+    return m_landmark_indices[landmark];
+}
+
+LandmarkDistance
+Landmarks::Distance(unsigned landmark, IndexType index, unsigned land_mask_row_size) const
+{
+    const auto x = index % land_mask_row_size / m_header->block_size;
+    const auto y = index / land_mask_row_size / m_header->block_size;
+
+    if (x >= m_header->block_row_size || y >= m_header->block_rows)
+    {
+        return {kUnknownLandmarkDistance, kUnknownLandmarkDistance};
+    }
+
+    const auto block_count = size_t {m_header->block_row_size} * m_header->block_rows;
+
+    return m_distances[landmark * block_count + y * m_header->block_row_size + x];
+}
+
+std::vector<uint32_t>
+BuildLandmarks(const LandMask& land_mask, unsigned count, unsigned block_size)
+{
+    // For the step costs and the bodies of water
+    const BuilderRouter router(land_mask);
+    const auto width = land_mask.Width();
+    const auto height = land_mask.Height();
+    constexpr auto kIgnoreLand = BuilderRouter::NeighborType::kIgnoreLand;
+
+    const auto cell_count = width * height;
+    const auto block_row_size = (width + block_size - 1) / block_size;
+    const auto block_rows = (height + block_size - 1) / block_size;
+    const auto block_count = block_row_size * block_rows;
+
+    count = std::min<unsigned>(count, kMaxLandmarks);
+
+    // The landmarks are placed in the largest body of water
+    std::vector<unsigned> component_size;
+    for (auto index = 0u; index < cell_count; index++)
+    {
+        if (const auto component = router.WaterComponent(index);
+            component != BuilderRouter::kUnknownComponent)
+        {
+            component_size.resize(std::max<size_t>(component_size.size(), component + 1));
+            component_size[component]++;
+        }
+    }
+    if (component_size.empty())
+    {
+        return {};
+    }
+
+    const auto largest = std::ranges::max_element(component_size) - component_size.begin();
+    auto next = kInvalidIndex;
+    for (auto index = 0u; index < cell_count && next == kInvalidIndex; index++)
+    {
+        if (router.WaterComponent(index) == largest)
+        {
+            next = index;
+        }
+    }
+
+    // Lower bound costs from one cell to all others (kNoCost where unreachable)
+    auto landmark_dijkstra = [&](IndexType from, std::vector<CostType>& costs) {
+        using Entry = std::pair<CostType, IndexType>;
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+
+        costs.assign(width * height, kNoCost);
+        costs[from] = 0;
+        queue.push({0, from});
+
+        while (!queue.empty())
+        {
+            const auto [cost, index] = queue.top();
+            queue.pop();
+
+            if (cost > costs[index])
+            {
+                continue;
+            }
+
+            for (auto neighbor_index : router.Neighbors(index, kIgnoreLand))
+            {
+                // The cheapest the step can be, in either direction, so that the costs are
+                // symmetric and never above the real ones
+                const auto direction = IndexPairToDirection(index, neighbor_index, width);
+                const auto newcost =
+                    cost + router.BaseCost(direction, direction) +
+                    std::min(router.LandPenalty(index), router.LandPenalty(neighbor_index));
+
+                if (newcost < costs[neighbor_index])
+                {
+                    costs[neighbor_index] = newcost;
+                    queue.push({newcost, neighbor_index});
+                }
+            }
+        }
+    };
+
+    std::vector<CostType> costs;
+    // The cost to the closest landmark so far
+    std::vector<CostType> closest(cell_count, kNoCost);
+    std::vector<IndexType> landmarks;
+    std::vector<uint32_t> distances;
+
+    // Start from the cell furthest away from an arbitrary one, and then add the cell furthest
+    // away from all the landmarks so far
+    landmark_dijkstra(next, costs);
+    next = std::ranges::max_element(costs, [](auto a, auto b) {
+               return (a == kNoCost ? 0 : a) < (b == kNoCost ? 0 : b);
+           }) -
+           costs.begin();
+
+    while (landmarks.size() < count)
+    {
+        landmarks.push_back(next);
+        landmark_dijkstra(next, costs);
+
+        std::vector<CostType> lowest(block_count, kNoCost);
+        std::vector<CostType> highest(block_count, 0);
+        CostType furthest = 0;
+
+        for (auto index = 0u; index < cell_count; index++)
+        {
+            const auto cost = costs[index];
+            if (cost == kNoCost)
+            {
+                continue;
+            }
+
+            const auto block =
+                index / width / block_size * block_row_size + index % width / block_size;
+            lowest[block] = std::min(lowest[block], cost);
+            highest[block] = std::max(highest[block], cost);
+
+            closest[index] = std::min(closest[index], cost);
+            if (closest[index] > furthest)
+            {
+                furthest = closest[index];
+                next = index;
+            }
+        }
+
+        for (auto block = 0u; block < block_count; block++)
+        {
+            if (lowest[block] == kNoCost || highest[block] >= kUnknownLandmarkDistance)
+            {
+                distances.push_back(kUnknownLandmarkDistance | kUnknownLandmarkDistance << 16);
+            }
+            else
+            {
+                distances.push_back(lowest[block] | highest[block] << 16);
+            }
+        }
+
+        if (furthest == 0)
+        {
+            // A tiny body of water, where all cells are landmarks
+            break;
+        }
+    }
+
+    const auto header = LandmarksHeader {
+        kLandmarksMagic,
+        block_size,
+        block_row_size,
+        block_rows,
+        static_cast<uint32_t>(landmarks.size()),
+    };
+    const auto header_words =
+        std::bit_cast<std::array<uint32_t, sizeof(LandmarksHeader) / sizeof(uint32_t)>>(header);
+
+    std::vector<uint32_t> out(header_words.begin(), header_words.end());
+    out.insert(out.end(), landmarks.begin(), landmarks.end());
+    out.insert(out.end(), distances.begin(), distances.end());
+
+    return out;
+}
@@ -0,0 +1,98 @@
+#include "route_cache.hh"
+
+#include <algorithm>
+
+RouteCache::RouteCache(unsigned land_mask_row_size, size_t budget, unsigned cell_size)
+    : m_row_size(land_mask_row_size)
+    , m_cell_size(cell_size)
+    , m_budget(budget)
+{
+}
+
+void
+RouteCache::SetBudget(size_t budget)
+{
+    m_budget = budget;
+    Evict(m_budget);
+}
+
+std::span<const IndexType>
+RouteCache::Lookup(IndexType from, IndexType to)
+{
+    const auto from_square = Square(from);
+    const auto to_square = Square(to);
+
+    auto it = std::ranges::find_if(m_entries, [from_square, to_square](const auto& entry) {
+        return entry.from_square == from_square && entry.to_square == to_square;
+    });
+    if (it == m_entries.end())
+    {
+        return {};
+    }
+
+    // Move to the front
+    std::rotate(m_entries.begin(), it, it + 1);
+
+    return m_entries.front().route;
+}
+
+void
+RouteCache::Insert(IndexType from, IndexType to, std::span<const IndexType> route)
+{
+    const auto from_square = Square(from);
+    const auto to_square = Square(to);
+    const auto size = EntrySize(route.size());
+
+    auto it = std::ranges::find_if(m_entries, [from_square, to_square](const auto& entry) {
+        return entry.from_square == from_square && entry.to_square == to_square;
+    });
+    if (it != m_entries.end())
+    {
+        m_size -= EntrySize(it->route.size());
+        m_entries.erase(it);
+    }
+
+    if (route.empty() || size > m_budget)
+    {
+        return;
+    }
+
+    Evict(m_budget - size);
+
+    m_entries.insert(m_entries.begin(),
+                     Entry {from_square, to_square, std::vector(route.begin(), route.end())});
+    m_size += size;
+}
+
+void
+RouteCache::Clear()
+{
+    m_entries.clear();
+    m_size = 0;
+}
+
+uint32_t
+RouteCache::Square(IndexType index) const
+{
+    const auto squares_per_row = (m_row_size + m_cell_size - 1) / m_cell_size;
+    const auto x = index % m_row_size;
+    const auto y = index / m_row_size;
+
+    return (y / m_cell_size) * squares_per_row + x / m_cell_size;
+}
+
+size_t
+RouteCache::EntrySize(size_t route_size)
+{
+    return sizeof(Entry) + route_size * sizeof(IndexType);
+}
+
+void
+RouteCache::Evict(size_t budget)
+{
+    while (m_size > budget)
+    {
+        m_size -= EntrySize(m_entries.back().route.size());
+        m_entries.pop_back();
+    }
+}
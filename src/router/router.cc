@@ -2,250 +2,2062 @@
 
 #include "route_utils.hh"
 
-template <size_t CACHE_SIZE>
-Router<CACHE_SIZE>::Router(std::span<const uint32_t> land_mask, unsigned height, unsigned width)
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+
+// Land within this distance of a cell makes it more expensive to enter, by kCoastPenalty
+constexpr auto kCoastPenaltyDistance = 2;
+// By CoastDistance(), i.e., 0 for land and kCoastPenaltyDistance + 1 when far enough from land
+constexpr std::array<CostType, kCoastPenaltyDistance + 2> kCoastPenalty = {0, 8, 2, 0};
+static_assert(kCoastPenaltyDistance + 1 <= 3, "The coast distance is stored in two bits");
+
+// Open water (where neither a cell nor its neighbors get the coast penalty) has no land this close
+constexpr auto kOpenWaterDistance = kCoastPenaltyDistance + 1;
+
+constexpr auto kMaxJumpDistance = 32u;
+
+// Route repair: rejoin the route this many cells ahead of the closest point
+constexpr auto kRejoinDistance = 16u;
+// The neighbors of a cell, in the order of the bits from WaterAround()
+constexpr std::array<Vector, 8> kNeighborDirections = {{
+    {-1, -1},
+    {0, -1},
+    {1, -1},
+    {-1, 0},
+    {1, 0},
+    {-1, 1},
+    {0, 1},
+    {1, 1},
+}};
+// How much further away than the closest water a reachable one may be, for points on land
+constexpr auto kReachableWaterSlack = 4u;
+constexpr uint16_t kOpenWaterCenter = 1 << 4;
+constexpr uint16_t kAllOpenWater = 0x1ff;
+
+// Number of abstract graph legs to refine in one go
+constexpr auto kRefineLegs = 4u;
+constexpr auto kNoCost = std::numeric_limits<CostType>::max();
+
+// The node lookup is done through pages of kNodePageSize x kNodePageSize cells
+constexpr auto kNodePageSize = 16u;
+constexpr auto kNodePageCells = kNodePageSize * kNodePageSize;
+// At most this many pages (1KiB each) are allocated, after which unused ones are recycled. Enough
+// to cover twice the target node cache, as the nodes of a search don't fill the pages at its edge
+constexpr auto kMaxNodePages = 2 * kTargetCacheSize / kNodePageCells;
+static_assert(kMaxNodePages < 0xffff);
+constexpr uint16_t kNoNodePage = 0xffff;
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+Router<CACHE_SIZE, OPEN_SET>::Router(std::span<const uint32_t> land_mask,
+                                     unsigned height,
+                                     unsigned width,
+                                     Engine engine)
+    : Router(LandMask(land_mask, width, height), engine)
+{
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+Router<CACHE_SIZE, OPEN_SET>::Router(const LandMask& land_mask, Engine engine)
     : m_land_mask(land_mask)
-    , m_height(height)
-    , m_width(width)
+    , m_height(land_mask.Height())
+    , m_width(land_mask.Width())
+    , m_engine(engine)
+    , m_node_page_row_size((m_width + kNodePageSize - 1) / kNodePageSize)
+{
+    m_node_page_table.resize(
+        2 * m_node_page_row_size * ((m_height + kNodePageSize - 1) / kNodePageSize), kNoNodePage);
+
+    SetEngine(engine);
+    BuildCoastDistance();
+    BuildWaterComponents();
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+void
+Router<CACHE_SIZE, OPEN_SET>::BuildCoastDistance()
+{
+    m_coast_distance.assign((m_width * m_height + 15) / 16, 0);
+
+    for (auto y = 0; y < static_cast<int>(m_height); y++)
+    {
+        for (auto x = 0; x < static_cast<int>(m_width); x += 16)
+        {
+            // Bit i is set if there is land within distance + 1 of x + i
+            std::array<uint32_t, kCoastPenaltyDistance> near_land {};
+
+            for (auto distance = 1; distance <= kCoastPenaltyDistance; distance++)
+            {
+                uint32_t land = 0;
+
+                for (auto row = y - distance; row <= y + distance; row++)
+                {
+                    land |= LandBits(x - distance, row);
+                }
+                for (auto i = 0; i <= 2 * distance; i++)
+                {
+                    near_land[distance - 1] |= land >> i;
+                }
+            }
+
+            const auto land = LandBits(x, y);
+            const auto cells = std::min(16, static_cast<int>(m_width) - x);
+
+            for (auto i = 0; i < cells; i++)
+            {
+                if (land & (1 << i))
+                {
+                    continue;
+                }
+
+                uint32_t distance = kCoastPenaltyDistance + 1;
+                for (auto bits : near_land)
+                {
+                    distance -= (bits >> i) & 1;
+                }
+
+                const auto index = y * m_width + x + i;
+                m_coast_distance[index / 16] |= distance << ((index % 16) * 2);
+            }
+        }
+    }
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+unsigned
+Router<CACHE_SIZE, OPEN_SET>::CoastDistance(IndexType index) const
+{
+    return (m_coast_distance[index / 16] >> ((index % 16) * 2)) & 3;
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+void
+Router<CACHE_SIZE, OPEN_SET>::BuildWaterComponents()
+{
+    static_assert(sizeof(WaterRun) == 4);
+    assert(m_width <= std::numeric_limits<uint16_t>::max() + 1);
+
+    // Union-find over the runs, where the root is the first run of the component
+    std::vector<uint16_t> first_x;
+    std::vector<uint32_t> parent;
+    auto find = [&parent](uint32_t run) {
+        while (parent[run] != run)
+        {
+            parent[run] = parent[parent[run]];
+            run = parent[run];
+        }
+        return run;
+    };
+
+    m_water_runs.clear();
+    m_water_row_start.assign(m_height + 1, 0);
+
+    for (auto y = 0u; y < m_height; y++)
+    {
+        m_water_row_start[y] = m_water_runs.size();
+        auto above = y > 0 ? m_water_row_start[y - 1] : 0;
+
+        for (auto x = 0u; x < m_width; x++)
+        {
+            if (!IsWater(m_land_mask, y * m_width + x))
+            {
+                continue;
+            }
+
+            const auto run = static_cast<uint32_t>(m_water_runs.size());
+            const auto first = x;
+            while (x + 1 < m_width && IsWater(m_land_mask, y * m_width + x + 1))
+            {
+                x++;
+            }
+
+            first_x.push_back(first);
+            parent.push_back(run);
+            m_water_runs.push_back({static_cast<uint16_t>(x), 0});
+
+            if (y == 0)
+            {
+                continue;
+            }
+
+            // Join with the runs above which touch this one, diagonally included
+            while (above < m_water_row_start[y] && m_water_runs[above].last_x + 1u < first)
+            {
+                above++;
+            }
+            for (auto cur = above; cur < m_water_row_start[y] && first_x[cur] <= x + 1; cur++)
+            {
+                const auto a = find(cur);
+                const auto b = find(run);
+
+                parent[std::max(a, b)] = std::min(a, b);
+            }
+        }
+    }
+    m_water_row_start[m_height] = m_water_runs.size();
+    m_water_runs.shrink_to_fit();
+
+    uint16_t components = 0;
+    for (auto run = 0u; run < m_water_runs.size(); run++)
+    {
+        if (const auto root = find(run); root != run)
+        {
+            m_water_runs[run].component = m_water_runs[root].component;
+        }
+        else
+        {
+            m_water_runs[run].component =
+                components < kUnknownComponent ? components++ : kUnknownComponent;
+        }
+    }
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+uint16_t
+Router<CACHE_SIZE, OPEN_SET>::WaterComponent(IndexType index) const
+{
+    if (index >= m_width * m_height || !IsWater(m_land_mask, index))
+    {
+        return kUnknownComponent;
+    }
+
+    const auto x = index % m_width;
+    const auto y = index / m_width;
+    const auto first = m_water_runs.begin() + m_water_row_start[y];
+    const auto last = m_water_runs.begin() + m_water_row_start[y + 1];
+
+    auto run = std::lower_bound(
+        first, last, x, [](const WaterRun& run, unsigned x) { return run.last_x < x; });
+
+    return run == last ? kUnknownComponent : run->component;
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+bool
+Router<CACHE_SIZE, OPEN_SET>::Reachable(IndexType from, IndexType to) const
+{
+    const auto a = WaterComponent(from);
+    const auto b = WaterComponent(to);
+
+    return a == kUnknownComponent || b == kUnknownComponent || a == b;
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+void
+Router<CACHE_SIZE, OPEN_SET>::SetEngine(Engine engine)
+{
+    m_engine = engine;
+
+    // Only needed by the bidirectional search, so not allocated unless used
+    if (m_engine == Engine::kBidirectional && !m_backward_open_set)
+    {
+        m_backward_open_set = std::make_unique<OPEN_SET<Node*, CACHE_SIZE>>();
+    }
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+void
+Router<CACHE_SIZE, OPEN_SET>::SetSmoothing(bool smoothing)
+{
+    m_smoothing = smoothing;
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+void
+Router<CACHE_SIZE, OPEN_SET>::SetHeuristicWeight(unsigned percent)
+{
+    assert(percent >= 100);
+
+    m_heuristic_weight = percent;
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+void
+Router<CACHE_SIZE, OPEN_SET>::SetExpansionLimit(unsigned expansions)
+{
+    m_expansion_limit = expansions;
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+void
+Router<CACHE_SIZE, OPEN_SET>::SetTimeLimit(std::function<bool()> time_up)
+{
+    m_time_up = std::move(time_up);
+    m_time_limit_countdown = kTimeLimitCheckInterval;
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+bool
+Router<CACHE_SIZE, OPEN_SET>::ExpansionLimitReached()
+{
+    auto reached = m_expansion_limit != 0 && m_stats.nodes_expanded >= m_expansion_limit;
+
+    if (!reached && m_time_up && --m_time_limit_countdown == 0)
+    {
+        m_time_limit_countdown = kTimeLimitCheckInterval;
+        reached = m_time_up();
+    }
+    if (!reached)
+    {
+        return false;
+    }
+    m_stats.expansion_limit_reached = true;
+
+    return true;
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+void
+Router<CACHE_SIZE, OPEN_SET>::SetAbstractGraph(const AbstractGraph* graph)
+{
+    // A graph built for another map would send the search out of the land mask
+    m_abstract_graph = graph && graph->Matches(m_width, m_height) ? graph : nullptr;
+
+    if (m_abstract_graph)
+    {
+        // Two extra nodes for the start and the destination
+        const auto node_count = m_abstract_graph->PortalCount() + 2;
+
+        m_abstract_g.resize(node_count);
+        m_abstract_parent.resize(node_count);
+        m_abstract_closed.resize(node_count);
+    }
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+std::span<const IndexType>
+Router<CACHE_SIZE, OPEN_SET>::CalculateRoute(Point from_point, Point to_point)
+{
+    auto from = PointToLandIndex(from_point, m_width);
+    auto to = PointToLandIndex(to_point, m_width);
+
+    return CalculateRoute(from, to);
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+std::span<const IndexType>
+Router<CACHE_SIZE, OPEN_SET>::CalculateRoute(IndexType from, IndexType to)
+{
+    if (!IsWater(m_land_mask, from))
+    {
+        from = FindNearestWater(from);
+    }
+    if (!IsWater(m_land_mask, to))
+    {
+        // Preferably in the same body of water
+        auto reachable = FindNearestWater(to, WaterComponent(from));
+        to = IsWater(m_land_mask, reachable) ? reachable : FindNearestWater(to);
+    }
+
+    ResetStats();
+    m_result.clear();
+
+    if (!Reachable(from, to))
+    {
+        // In another body of water, so no need to search
+        return {};
+    }
+
+    if (m_abstract_graph &&
+        m_abstract_graph->ClusterOf(from, m_width) != m_abstract_graph->ClusterOf(to, m_width))
+    {
+        if (CalculateAbstractRoute(from, to))
+        {
+            return FinishResult();
+        }
+        if (m_stats.expansion_limit_reached)
+        {
+            return {};
+        }
+
+        // Fall back to the regular search
+        m_result.clear();
+    }
+
+    for (auto i = 0; i < 100; i++)
+    {
+        auto rc = RunAstar(from, to);
+        if (rc == Router::AstarResult::kNoPath ||
+            rc == Router::AstarResult::kExpansionLimitReached)
+        {
+            return {};
+        }
+        else
+        {
+            AppendCurrentResult();
+
+            if (rc == Router::AstarResult::kPathFound)
+            {
+                return FinishResult();
+            }
+            else
+            {
+                from = m_current_result.front();
+            }
+            m_current_result.clear();
+        }
+
+        m_stats.partial_paths++;
+    }
+
+    return {};
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+std::span<const IndexType>
+Router<CACHE_SIZE, OPEN_SET>::RepairRoute(IndexType from, std::span<const IndexType> route)
+{
+    ResetStats();
+
+    if (route.empty())
+    {
+        return {};
+    }
+
+    if (!IsWater(m_land_mask, from))
+    {
+        from = FindNearestWater(from);
+    }
+
+    auto rejoin = NearestOnRoute(from, route);
+
+    if (rejoin.distance > kMaxRepairDistance)
+    {
+        // The full search is left to the caller
+        return {};
+    }
+
+    // Move ahead on the route, to not turn back to the closest point
+    for (auto steps = 0u; steps < kRejoinDistance && rejoin.segment + 1 < route.size();)
+    {
+        const auto next = route[rejoin.segment + 1];
+
+        WalkLine(rejoin.index, next, [&rejoin, &steps](IndexType index) {
+            rejoin.index = index;
+            return ++steps < kRejoinDistance;
+        });
+        if (rejoin.index == next)
+        {
+            rejoin.segment++;
+        }
+    }
+
+    // route might be the current result
+    std::vector<IndexType> rest(route.begin() + rejoin.segment + 1, route.end());
+
+    m_result.clear();
+
+    // Within the node cache, so a single local search
+    if (RunAstar(from, rejoin.index) != Router::AstarResult::kPathFound)
+    {
+        m_current_result.clear();
+        return {};
+    }
+
+    AppendCurrentResult();
+    m_current_result.clear();
+    if (m_result.empty())
+    {
+        m_result.push_back(rejoin.index);
+    }
+
+    for (auto index : rest)
+    {
+        if (index != m_result.back())
+        {
+            m_result.push_back(index);
+        }
+    }
+
+    return FinishResult();
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+std::vector<std::vector<IndexType>>
+Router<CACHE_SIZE, OPEN_SET>::CalculateRoutes(IndexType from,
+                                              std::span<const IndexType> destinations)
+{
+    std::vector<std::vector<IndexType>> out(destinations.size());
+    std::vector<IndexType> targets;
+    auto remaining = destinations.size();
+
+    if (!IsWater(m_land_mask, from))
+    {
+        from = FindNearestWater(from);
+    }
+    for (auto destination : destinations)
+    {
+        auto target = destination;
+
+        if (!IsWater(m_land_mask, target))
+        {
+            auto reachable = FindNearestWater(target, WaterComponent(from));
+            target = IsWater(m_land_mask, reachable) ? reachable : FindNearestWater(target);
+        }
+        if (!Reachable(from, target))
+        {
+            // Left empty, without searching for it
+            target = kInvalidIndex;
+            remaining--;
+        }
+        targets.push_back(target);
+    }
+
+    // The closest remaining target. It only grows when a target is reached and dropped, so it stays
+    // admissible, but the f of the nodes already in the open set are then too low
+    auto heuristic = [this, &targets, &out](IndexType index) {
+        auto best = std::numeric_limits<CostType>::max();
+
+        for (auto i = 0u; i < targets.size(); i++)
+        {
+            if (out[i].empty() && targets[i] != kInvalidIndex)
+            {
+                best = std::min(best, Heuristic(index, targets[i]));
+            }
+        }
+
+        return best;
+    };
+
+    ResetStats();
+    if (remaining == 0)
+    {
+        return out;
+    }
+
+    m_current_result.clear();
+    m_open_set.Clear();
+    NextGeneration();
+
+    auto p = GetNode(from);
+    p->f = heuristic(from);
+    p->parent = nullptr;
+
+    m_open_set.Push(p);
+    p->Open();
+
+    while (auto cur = m_open_set.Pop())
+    {
+        const auto before = remaining;
+
+        for (auto i = 0u; i < targets.size(); i++)
+        {
+            if (targets[i] != cur->index || !out[i].empty())
+            {
+                continue;
+            }
+
+            ProduceResult(cur);
+            if (m_current_result.empty())
+            {
+                // Already there
+                m_current_result.push_back(cur->index);
+            }
+            out[i].assign(m_current_result.rbegin(), m_current_result.rend());
+            m_current_result.clear();
+            if (m_smoothing)
+            {
+                SmoothRoute(out[i]);
+            }
+            remaining--;
+        }
+
+        if (remaining == 0)
+        {
+            break;
+        }
+        if (remaining != before)
+        {
+            // Re-key the open set for the remaining targets, so that the nodes are taken in the
+            // right order again
+            m_open_set.Clear();
+            for (auto& node : m_nodes)
+            {
+                if (&node != cur && node.IsOpen())
+                {
+                    node.f = node.g + heuristic(node.index);
+                    m_open_set.Push(&node);
+                }
+            }
+        }
+
+        auto parent_direction = Vector::Standstill();
+
+        if (cur->parent)
+        {
+            parent_direction = IndexPairToDirection(cur->parent->index, cur->index, m_width);
+        }
+
+        // Cell by cell, since jumps only stop for a single destination
+        for (auto neighbor_index : Neighbors(cur->index, NeighborType::kIgnoreLand))
+        {
+            auto neighbor_node = GetNode(neighbor_index);
+
+            m_stats.nodes_expanded++;
+            if (!neighbor_node)
+            {
+                // The node cache is full, so the rest are out of reach
+                return out;
+            }
+
+            const auto direction = IndexPairToDirection(cur->index, neighbor_index, m_width);
+            auto newg = cur->g + StepCost(neighbor_index, direction, parent_direction);
+
+            if ((neighbor_node->IsOpen() || neighbor_node->IsClosed()) && neighbor_node->g <= newg)
+            {
+                continue;
+            }
+
+            neighbor_node->parent = cur;
+            neighbor_node->g = newg;
+            neighbor_node->f = newg + heuristic(neighbor_index);
+
+            if (!neighbor_node->IsOpen())
+            {
+                m_open_set.Push(neighbor_node);
+                neighbor_node->Open();
+            }
+            else
+            {
+                m_open_set.Decrease(neighbor_node);
+            }
+        }
+
+        cur->Close();
+    }
+
+    return out;
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+unsigned
+Router<CACHE_SIZE, OPEN_SET>::DistanceToRoute(IndexType index,
+                                              std::span<const IndexType> route) const
+{
+    if (route.empty())
+    {
+        return std::numeric_limits<unsigned>::max();
+    }
+
+    return NearestOnRoute(index, route).distance;
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+Router<CACHE_SIZE, OPEN_SET>::RoutePosition
+Router<CACHE_SIZE, OPEN_SET>::NearestOnRoute(IndexType index,
+                                             std::span<const IndexType> route) const
+{
+    RoutePosition out {0, route.front(), CellDistance(index, route.front())};
+
+    for (auto segment = 0u; segment + 1 < route.size(); segment++)
+    {
+        const auto end = route[segment + 1];
+
+        WalkLine(route[segment], end, [this, index, segment, end, &out](IndexType cur) {
+            // The later one on ties, to keep going forward
+            if (auto distance = CellDistance(index, cur); distance <= out.distance)
+            {
+                out = {cur == end ? segment + 1 : segment, cur, distance};
+            }
+
+            return true;
+        });
+    }
+
+    return out;
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+unsigned
+Router<CACHE_SIZE, OPEN_SET>::CellDistance(IndexType a, IndexType b) const
+{
+    const auto dx = std::abs(static_cast<int>(a % m_width) - static_cast<int>(b % m_width));
+    const auto dy = std::abs(static_cast<int>(a / m_width) - static_cast<int>(b / m_width));
+
+    return std::max(dx, dy);
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+void
+Router<CACHE_SIZE, OPEN_SET>::ResetStats()
+{
+    m_stats.Reset();
+    m_open_set.ResetHighWater();
+    if (m_backward_open_set)
+    {
+        m_backward_open_set->ResetHighWater();
+    }
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+void
+Router<CACHE_SIZE, OPEN_SET>::AppendCurrentResult()
+{
+    auto top = kInvalidIndex;
+
+    // When merging, avoid repeating the end node of the previous path
+    if (!m_result.empty())
+    {
+        top = m_result.back();
+    }
+
+    for (auto rit = m_current_result.rbegin(); rit != m_current_result.rend(); ++rit)
+    {
+        if (*rit == top)
+        {
+            continue;
+        }
+        m_result.push_back(*rit);
+    }
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+std::span<const IndexType>
+Router<CACHE_SIZE, OPEN_SET>::FinishResult()
+{
+    if (m_smoothing)
+    {
+        SmoothRoute(m_result);
+    }
+
+    return m_result;
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+void
+Router<CACHE_SIZE, OPEN_SET>::SmoothRoute(std::vector<IndexType>& route) const
+{
+    if (route.size() <= 2)
+    {
+        return;
+    }
+
+    // Skip points while there is line of sight from the last kept one to the point after. The
+    // line must stay as far from the coast as the route it replaces, not counting the ends
+    auto anchor = route.front();
+    auto previous = route.front();
+    auto clearance = static_cast<unsigned>(kOpenWaterDistance);
+    auto kept = 1u;
+
+    for (auto i = 1u; i + 1 < route.size(); i++)
+    {
+        const auto cur = route[i];
+
+        clearance = std::min(clearance, LineClearance(previous, cur));
+        previous = cur;
+
+        if (LineOfSight(anchor, route[i + 1], clearance))
+        {
+            continue;
+        }
+
+        route[kept++] = cur;
+        anchor = cur;
+        clearance = kOpenWaterDistance;
+    }
+    route[kept++] = route.back();
+    route.resize(kept);
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+unsigned
+Router<CACHE_SIZE, OPEN_SET>::LineClearance(IndexType from, IndexType to) const
+{
+    auto out = static_cast<unsigned>(kOpenWaterDistance);
+
+    WalkLine(from, to, [this, &out](IndexType index) {
+        out = std::min(out, CoastDistance(index));
+        return true;
+    });
+
+    return out;
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+bool
+Router<CACHE_SIZE, OPEN_SET>::LineOfSight(IndexType from, IndexType to, unsigned clearance) const
+{
+    auto last = from;
+
+    return WalkLine(from, to, [this, to, clearance, &last](IndexType index) {
+        const auto dx = static_cast<int>(index % m_width) - static_cast<int>(last % m_width);
+        const auto dy = static_cast<int>(index / m_width) - static_cast<int>(last / m_width);
+
+        // Don't squeeze diagonally between two land cells
+        if (dx != 0 && dy != 0 &&
+            (!IsWater(m_land_mask, last + dx) ||
+             !IsWater(m_land_mask, last + dy * static_cast<int>(m_width))))
+        {
+            return false;
+        }
+        last = index;
+
+        return index == to || CoastDistance(index) >= std::max(clearance, 1u);
+    });
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+CostType
+Router<CACHE_SIZE, OPEN_SET>::RouteCost(std::span<const IndexType> route) const
+{
+    CostType cost = 0;
+    auto parent_direction = Vector::Standstill();
+
+    for (auto i = 1u; i < route.size(); i++)
+    {
+        auto cur = route[i - 1];
+
+        WalkLine(route[i - 1], route[i], [&](IndexType index) {
+            const auto direction = IndexPairToDirection(cur, index, m_width);
+
+            cost += StepCost(index, direction, parent_direction);
+            parent_direction = direction;
+            cur = index;
+
+            return true;
+        });
+    }
+
+    return cost;
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+template <typename F>
+bool
+Router<CACHE_SIZE, OPEN_SET>::WalkLine(IndexType from, IndexType to, F&& visit) const
+{
+    auto x = static_cast<int>(from % m_width);
+    auto y = static_cast<int>(from / m_width);
+    const auto to_x = static_cast<int>(to % m_width);
+    const auto to_y = static_cast<int>(to / m_width);
+    const auto dx = std::abs(to_x - x);
+    const auto dy = -std::abs(to_y - y);
+    const auto step_x = x < to_x ? 1 : -1;
+    const auto step_y = y < to_y ? 1 : -1;
+    auto error = dx + dy;
+
+    while (x != to_x || y != to_y)
+    {
+        const auto error2 = 2 * error;
+
+        if (error2 >= dy)
+        {
+            error += dy;
+            x += step_x;
+        }
+        if (error2 <= dx)
+        {
+            error += dx;
+            y += step_y;
+        }
+
+        if (!visit(static_cast<IndexType>(y * m_width + x)))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+bool
+Router<CACHE_SIZE, OPEN_SET>::CalculateAbstractRoute(IndexType from, IndexType to)
+{
+    const auto& graph = *m_abstract_graph;
+    const auto cluster_size = graph.ClusterSize();
+    const auto start = graph.PortalCount();
+    const auto goal = start + 1;
+
+    PrepareLandmarks(to);
+
+    auto local_index = [this, cluster_size](IndexType index) {
+        return (index / m_width % cluster_size) * cluster_size + index % m_width % cluster_size;
+    };
+    auto node_index = [&graph, start, from, to](uint32_t node) {
+        return node < start ? graph.PortalIndex(node) : node == start ? from : to;
+    };
+
+    // Costs from the start to the portals in its cluster, and from the portals to the destination
+    std::vector<CostType> from_costs;
+    std::vector<CostType> to_costs;
+    ClusterDijkstra(from, cluster_size, false, from_costs);
+    ClusterDijkstra(to, cluster_size, true, to_costs);
+
+    const auto [from_first, from_last] = graph.PortalRange(graph.ClusterOf(from, m_width));
+    const auto [to_first, to_last] = graph.PortalRange(graph.ClusterOf(to, m_width));
+
+    std::ranges::fill(m_abstract_g, kNoCost);
+    m_abstract_closed.assign(m_abstract_closed.size(), false);
+
+    using Entry = std::pair<CostType, uint32_t>;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> open_set;
+
+    auto relax = [&](uint32_t node, uint32_t next, CostType cost) {
+        const auto newg = m_abstract_g[node] + cost;
+
+        if (!m_abstract_closed[next] && newg < m_abstract_g[next])
+        {
+            m_abstract_g[next] = newg;
+            m_abstract_parent[next] = node;
+            open_set.push({newg + Heuristic(node_index(next), to), next});
+        }
+    };
+
+    m_abstract_g[start] = 0;
+    open_set.push({Heuristic(from, to), start});
+
+    while (!open_set.empty() && !m_abstract_closed[goal])
+    {
+        const auto node = open_set.top().second;
+        open_set.pop();
+
+        if (m_abstract_closed[node])
+        {
+            continue;
+        }
+        m_abstract_closed[node] = true;
+        m_stats.abstract_nodes_expanded++;
+
+        if (node == start)
+        {
+            for (auto portal = from_first; portal < from_last; portal++)
+            {
+                const auto cost = from_costs[local_index(graph.PortalIndex(portal))];
+                if (cost != kNoCost)
+                {
+                    relax(node, portal, cost);
+                }
+            }
+        }
+        else if (node != goal)
+        {
+            for (auto edge : graph.Edges(node))
+            {
+                relax(node, edge.to, edge.cost);
+            }
+
+            if (node >= to_first && node < to_last)
+            {
+                const auto cost = to_costs[local_index(graph.PortalIndex(node))];
+                if (cost != kNoCost)
+                {
+                    relax(node, goal, cost);
+                }
+            }
+        }
+    }
+
+    if (!m_abstract_closed[goal])
+    {
+        return false;
+    }
+
+    std::vector<IndexType> waypoints;
+    for (auto node = goal; node != start; node = m_abstract_parent[node])
+    {
+        waypoints.push_back(node_index(node));
+    }
+    waypoints.push_back(from);
+    std::ranges::reverse(waypoints);
+
+    // Refine a few legs at a time, so that the route isn't forced through every portal
+    for (auto cur = 0u; cur + 1 < waypoints.size();)
+    {
+        auto next = std::min<size_t>(cur + kRefineLegs, waypoints.size() - 1);
+        auto rc = RunAstar(waypoints[cur], waypoints[next]);
+
+        if (rc != Router::AstarResult::kPathFound && next > cur + 1)
+        {
+            // Too far for the node cache, take one leg at a time
+            next = cur + 1;
+            rc = RunAstar(waypoints[cur], waypoints[next]);
+        }
+        if (rc != Router::AstarResult::kPathFound)
+        {
+            return false;
+        }
+
+        AppendCurrentResult();
+        m_current_result.clear();
+        cur = next;
+    }
+
+    // The legs were refined separately, so drop the points where the direction doesn't change
+    if (m_result.size() > 2)
+    {
+        auto kept = 1u;
+
+        for (auto i = 1u; i + 1 < m_result.size(); i++)
+        {
+            if (IndexPairToDirection(m_result[kept - 1], m_result[i], m_width) !=
+                IndexPairToDirection(m_result[i], m_result[i + 1], m_width))
+            {
+                m_result[kept++] = m_result[i];
+            }
+        }
+        m_result[kept++] = m_result.back();
+        m_result.resize(kept);
+    }
+
+    return true;
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+void
+Router<CACHE_SIZE, OPEN_SET>::ClusterDijkstra(IndexType from,
+                                              unsigned cluster_size,
+                                              bool reverse,
+                                              std::vector<CostType>& costs) const
+{
+    // Costs from one cell to all others in its cluster, without leaving the cluster. In reverse,
+    // the costs are for going from the other cells to this one
+    const auto x0 = from % m_width / cluster_size * cluster_size;
+    const auto y0 = from / m_width / cluster_size * cluster_size;
+    const auto x1 = std::min(x0 + cluster_size, m_width);
+    const auto y1 = std::min(y0 + cluster_size, m_height);
+
+    auto local_index = [=, this](IndexType index) {
+        return (index / m_width - y0) * cluster_size + index % m_width - x0;
+    };
+
+    using Entry = std::pair<CostType, IndexType>;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+
+    costs.assign(cluster_size * cluster_size, kNoCost);
+    costs[local_index(from)] = 0;
+    queue.push({0, from});
+
+    while (!queue.empty())
+    {
+        const auto [cost, index] = queue.top();
+        queue.pop();
+
+        if (cost > costs[local_index(index)])
+        {
+            continue;
+        }
+
+        for (auto neighbor_index : Neighbors(index, NeighborType::kIgnoreLand))
+        {
+            const auto x = neighbor_index % m_width;
+            const auto y = neighbor_index / m_width;
+
+            if (x < x0 || x >= x1 || y < y0 || y >= y1)
+            {
+                continue;
+            }
+
+            const auto direction = IndexPairToDirection(index, neighbor_index, m_width);
+            const auto newcost =
+                cost + BaseCost(direction, Vector::Standstill()) +
+                LandPenalty(reverse ? index : neighbor_index);
+            auto& neighbor_cost = costs[local_index(neighbor_index)];
+
+            if (newcost < neighbor_cost)
+            {
+                neighbor_cost = newcost;
+                queue.push({newcost, neighbor_index});
+            }
+        }
+    }
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+void
+Router<CACHE_SIZE, OPEN_SET>::SetLandmarks(const Landmarks* landmarks)
+{
+    // Tables for another map would give an inadmissible heuristic, and costlier routes
+    m_landmarks = landmarks && landmarks->Matches(m_width, m_height) ? landmarks : nullptr;
+    m_landmark_target = kInvalidIndex;
+    m_target_landmarks.clear();
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+void
+Router<CACHE_SIZE, OPEN_SET>::PrepareLandmarks(IndexType to)
+{
+    if (to != m_landmark_target)
+    {
+        m_landmark_target = to;
+        m_target_landmarks.clear();
+
+        const auto component = WaterComponent(to);
+
+        for (auto landmark = 0u; m_landmarks && landmark < m_landmarks->Count(); landmark++)
+        {
+            const auto distance = m_landmarks->Distance(landmark, to, m_width);
+
+            // Landmarks in other bodies of water don't bound anything
+            if (component != kUnknownComponent &&
+                WaterComponent(m_landmarks->LandmarkIndex(landmark)) == component &&
+                distance.lowest != kUnknownLandmarkDistance)
+            {
+                m_target_landmarks.push_back({landmark, distance});
+            }
+        }
+    }
+
+    m_stats.landmarks = m_target_landmarks.size();
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+CostType
+Router<CACHE_SIZE, OPEN_SET>::LandmarkHeuristic(IndexType from) const
+{
+    CostType out = 0;
+
+    for (const auto& [landmark, to_distance] : m_target_landmarks)
+    {
+        const auto distance = m_landmarks->Distance(landmark, from, m_width);
+
+        if (distance.lowest == kUnknownLandmarkDistance)
+        {
+            continue;
+        }
+
+        // The triangle inequality, with the landmark on either side
+        if (to_distance.lowest > distance.highest)
+        {
+            out = std::max<CostType>(out, to_distance.lowest - distance.highest);
+        }
+        if (distance.lowest > to_distance.highest)
+        {
+            out = std::max<CostType>(out, distance.lowest - to_distance.highest);
+        }
+    }
+
+    return out;
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+Router<CACHE_SIZE, OPEN_SET>::AstarResult
+Router<CACHE_SIZE, OPEN_SET>::RunAstar(IndexType from, IndexType to)
+{
+    PrepareLandmarks(to);
+    if (m_engine == Engine::kBidirectional)
+    {
+        return RunBidirectionalAstar(from, to);
+    }
+
+    return RunForwardAstar(from, to);
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+Router<CACHE_SIZE, OPEN_SET>::AstarResult
+Router<CACHE_SIZE, OPEN_SET>::RunForwardAstar(IndexType from, IndexType to)
+{
+    m_current_result.clear();
+    m_open_set.Clear();
+    NextGeneration();
+
+    auto p = GetNode(from);
+
+    p->f = p->g + Heuristic(from, to); /* g+h */
+    p->parent = nullptr;
+
+    m_open_set.Push(p);
+    p->Open();
+
+    /* While there are nodes in the Open set */
+    while (auto cur = m_open_set.Pop())
+    {
+        if (ExpansionLimitReached())
+        {
+            return Router::AstarResult::kExpansionLimitReached;
+        }
+
+        /* We found a path! */
+        if (cur->index == to)
+        {
+            ProduceResult(cur);
+
+            return Router::AstarResult::kPathFound;
+        }
+
+        auto parent_direction = Vector::Standstill();
+
+        if (cur->parent)
+        {
+            parent_direction = IndexPairToDirection(cur->parent->index, cur->index, m_width);
+        }
+
+        /* Iterate over the neighbors (or jump points) */
+        for (auto [neighbor_index, cost] : Successors(cur, to, parent_direction))
+        {
+            auto neighbor_node = GetNode(neighbor_index);
+
+            m_stats.nodes_expanded++;
+            if (!neighbor_node)
+            {
+                ProduceResult(cur);
+
+                return Router::AstarResult::kMaxNodesReached;
+            }
+
+            auto newg = cur->g + cost;
+
+            if ((neighbor_node->IsOpen() || neighbor_node->IsClosed()) && neighbor_node->g <= newg)
+            {
+                // We have a better value or this is not valid
+                continue;
+            }
+            if (neighbor_node->IsClosed() && m_heuristic_weight != 100)
+            {
+                // Weighted A* keeps its bound without reopening, which would mostly redo the
+                // greedy detours
+                continue;
+            }
+
+            neighbor_node->parent = cur;
+            neighbor_node->g = newg;
+            neighbor_node->f = neighbor_node->g + Heuristic(neighbor_index, to); // g+h
+
+            if (!neighbor_node->IsOpen())
+            {
+                m_open_set.Push(neighbor_node);
+                neighbor_node->Open();
+            }
+            else
+            {
+                m_open_set.Decrease(neighbor_node);
+            }
+        }
+
+        cur->Close();
+    }
+
+    /* There was no path */
+    return Router::AstarResult::kNoPath;
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+Router<CACHE_SIZE, OPEN_SET>::AstarResult
+Router<CACHE_SIZE, OPEN_SET>::RunBidirectionalAstar(IndexType from, IndexType to)
+{
+    m_current_result.clear();
+    m_open_set.Clear();
+    m_backward_open_set->Clear();
+    NextGeneration();
+
+    if (from == to)
+    {
+        return Router::AstarResult::kPathFound;
+    }
+
+    // The backward search runs from to, with the nodes pointing towards it. Its g is the cost
+    // from the node to the target, without the straight line bonus of the first step (which
+    // depends on how the node is entered)
+    auto forward = GetNode(from);
+    auto backward = GetNode(to, true);
+
+    forward->f = Heuristic(from, to);
+    forward->parent = nullptr;
+    m_open_set.Push(forward);
+    forward->Open();
+
+    backward->f = Heuristic(to, from);
+    backward->parent = nullptr;
+    m_backward_open_set->Push(backward);
+    backward->Open();
+
+    auto entering_direction = [this](const Node* node) {
+        return node->parent ? IndexPairToDirection(node->parent->index, node->index, m_width)
+                            : Vector::Standstill();
+    };
+    auto leaving_direction = [this](const Node* node) {
+        return node->parent ? IndexPairToDirection(node->index, node->parent->index, m_width)
+                            : Vector::Standstill();
+    };
+
+    // The cheapest complete route seen so far, through a cell reached from both sides
+    auto best_cost = kNoCost;
+    const Node* best_forward = nullptr;
+    const Node* best_backward = nullptr;
+
+    auto meet = [&](const Node* forward_node, const Node* backward_node) {
+        // Only nodes of the current search are found, so they have been reached
+        if (!forward_node || !backward_node)
+        {
+            return;
+        }
+
+        // The backward g lacks the bonus for going straight through the meeting cell
+        const auto straight =
+            entering_direction(forward_node) == leaving_direction(backward_node);
+        const auto cost = forward_node->g + backward_node->g - (straight ? 1 : 0);
+
+        if (cost < best_cost)
+        {
+            best_cost = cost;
+            best_forward = forward_node;
+            best_backward = backward_node;
+        }
+    };
+
+    // For a partial path when the node cache runs out
+    const Node* last_forward = forward;
+    auto forward_turn = true;
+    auto out_of_nodes = false;
+
+    while (!out_of_nodes)
+    {
+        auto& open_set = forward_turn ? m_open_set : *m_backward_open_set;
+        auto cur = open_set.Pop();
+
+        // With an admissible heuristic, nothing left on this side can improve the route
+        if (!cur || cur->f >= best_cost)
+        {
+            break;
+        }
+        if (ExpansionLimitReached())
+        {
+            return Router::AstarResult::kExpansionLimitReached;
+        }
+
+        if (forward_turn)
+        {
+            last_forward = cur;
+        }
+
+        const auto parent_direction =
+            forward_turn ? entering_direction(cur) : leaving_direction(cur);
+
+        for (auto neighbor_index : Neighbors(cur->index, NeighborType::kIgnoreLand))
+        {
+            auto neighbor_node = GetNode(neighbor_index, !forward_turn);
+
+            m_stats.nodes_expanded++;
+            if (!neighbor_node)
+            {
+                if (best_forward)
+                {
+                    // Not necessarily the best, but good enough
+                    m_stats.meeting_unproven = true;
+                    out_of_nodes = true;
+                    break;
+                }
+                if (!last_forward->parent)
+                {
+                    // The backward search took the nodes before the forward one got anywhere, so
+                    // no partial path. Let a forward only search have all of them instead
+                    return RunForwardAstar(from, to);
+                }
+                ProduceResult(last_forward);
+
+                return Router::AstarResult::kMaxNodesReached;
+            }
+
+            CostType newg;
+            if (forward_turn)
+            {
+                newg = cur->g +
+                       StepCost(neighbor_index,
+                                IndexPairToDirection(cur->index, neighbor_index, m_width),
+                                parent_direction);
+            }
+            else
+            {
+                // The step from the neighbor to cur, which gets the bonus if it continues straight
+                const auto step = IndexPairToDirection(neighbor_index, cur->index, m_width);
+                newg = cur->g + StepCost(cur->index, step, Vector::Standstill()) -
+                       (step == parent_direction ? 1 : 0);
+            }
+
+            if ((neighbor_node->IsOpen() || neighbor_node->IsClosed()) && neighbor_node->g <= newg)
+            {
+                continue;
+            }
+
+            neighbor_node->parent = cur;
+            neighbor_node->g = newg;
+            neighbor_node->f = newg + Heuristic(neighbor_index, forward_turn ? to : from);
+
+            if (!neighbor_node->IsOpen())
+            {
+                open_set.Push(neighbor_node);
+                neighbor_node->Open();
+            }
+            else
+            {
+                open_set.Decrease(neighbor_node);
+            }
+
+            if (forward_turn)
+            {
+                meet(neighbor_node, FindNode(neighbor_index, true));
+            }
+            else
+            {
+                meet(FindNode(neighbor_index, false), neighbor_node);
+            }
+        }
+
+        cur->Close();
+        forward_turn = !forward_turn;
+    }
+
+    if (!best_forward)
+    {
+        /* There was no path */
+        return Router::AstarResult::kNoPath;
+    }
+
+    // Both halves, from the start to the target
+    std::vector<IndexType> cells;
+    for (auto node = best_forward; node; node = node->parent)
+    {
+        cells.push_back(node->index);
+    }
+    std::ranges::reverse(cells);
+    for (auto node = best_backward->parent; node; node = node->parent)
+    {
+        cells.push_back(node->index);
+    }
+
+    // Only the direction changes, from the end (as ProduceResult)
+    auto last_direction = Vector::Standstill();
+    for (auto i = cells.size() - 1; i > 0; i--)
+    {
+        const auto next_direction = IndexPairToDirection(cells[i], cells[i - 1], m_width);
+
+        if (next_direction != last_direction)
+        {
+            m_current_result.push_back(cells[i]);
+        }
+        last_direction = next_direction;
+    }
+    m_current_result.push_back(cells.front());
+
+    return Router::AstarResult::kPathFound;
+}
+
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+Router<CACHE_SIZE, OPEN_SET>::Node*
+Router<CACHE_SIZE, OPEN_SET>::GetNode(IndexType index, bool backward)
+{
+    auto slot = NodeSlot(index, backward);
+    if (!slot)
+    {
+        return nullptr;
+    }
+
+    if ((*slot >> 16) == m_generation)
+    {
+        return &m_nodes[*slot & 0xffff];
+    }
+
+    if (m_nodes.full())
+    {
+        return nullptr;
+    }
+
+    *slot = (static_cast<uint32_t>(m_generation) << 16) | m_nodes.size();
+    m_nodes.emplace_back();
+    m_stats.nodes_used = std::max<unsigned>(m_stats.nodes_used, m_nodes.size());
+
+    auto node = &m_nodes.back();
+    node->index = index;
+
+    return node;
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+Router<CACHE_SIZE, OPEN_SET>::Node*
+Router<CACHE_SIZE, OPEN_SET>::FindNode(IndexType index, bool backward) const
+{
+    const auto page_index = m_node_page_table[NodePagePosition(index, backward)];
+    if (page_index == kNoNodePage)
+    {
+        return nullptr;
+    }
+
+    const auto x = index % m_width;
+    const auto y = index / m_width;
+    const auto slot =
+        m_node_pages[page_index].slots[(y % kNodePageSize) * kNodePageSize + x % kNodePageSize];
+
+    if ((slot >> 16) != m_generation)
+    {
+        return nullptr;
+    }
+
+    return const_cast<Node*>(&m_nodes[slot & 0xffff]);
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+uint32_t
+Router<CACHE_SIZE, OPEN_SET>::NodePagePosition(IndexType index, bool backward) const
+{
+    const auto x = index % m_width;
+    const auto y = index / m_width;
+    const auto position = (y / kNodePageSize) * m_node_page_row_size + x / kNodePageSize;
+
+    return backward ? position + m_node_page_table.size() / 2 : position;
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+uint32_t*
+Router<CACHE_SIZE, OPEN_SET>::NodeSlot(IndexType index, bool backward)
+{
+    const auto x = index % m_width;
+    const auto y = index / m_width;
+    const auto position = NodePagePosition(index, backward);
+
+    auto page_index = m_node_page_table[position];
+    if (page_index == kNoNodePage)
+    {
+        page_index = AllocateNodePage(position);
+        if (page_index == kNoNodePage)
+        {
+            return nullptr;
+        }
+    }
+
+    auto& page = m_node_pages[page_index];
+
+    // In use by this search, so not possible to recycle
+    page.generation = m_generation;
+
+    return &page.slots[(y % kNodePageSize) * kNodePageSize + x % kNodePageSize];
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+uint16_t
+Router<CACHE_SIZE, OPEN_SET>::AllocateNodePage(uint32_t position)
+{
+    if (m_node_pages.size() < kMaxNodePages)
+    {
+        // Zero-initialized, i.e., no node in any generation
+        m_node_pages.push_back(
+            {std::make_unique<uint32_t[]>(kNodePageCells), position, m_generation});
+        m_node_page_table[position] = m_node_pages.size() - 1;
+
+        return m_node_pages.size() - 1;
+    }
+
+    // Take over a page from an earlier search. The stamps in it are all from older generations
+    for (auto i = 0u; i < m_node_pages.size(); i++)
+    {
+        const auto candidate = (m_next_recycled_page + i) % m_node_pages.size();
+        auto& page = m_node_pages[candidate];
+
+        if (page.generation != m_generation)
+        {
+            m_node_page_table[page.position] = kNoNodePage;
+            m_node_page_table[position] = candidate;
+            page.position = position;
+            m_next_recycled_page = candidate + 1;
+
+            return candidate;
+        }
+    }
+
+    // All pages used in this search, handled as a full node cache
+    return kNoNodePage;
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+void
+Router<CACHE_SIZE, OPEN_SET>::NextGeneration()
+{
+    m_nodes.clear();
+
+    if (++m_generation == 0)
+    {
+        // Wrapped around, so the old stamps can't be told apart from new ones anymore
+        for (auto& page : m_node_pages)
+        {
+            std::fill_n(page.slots.get(), kNodePageCells, 0);
+            page.generation = 0;
+        }
+        m_generation = 1;
+    }
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+etl::vector<IndexType, 8>
+Router<CACHE_SIZE, OPEN_SET>::Neighbors(IndexType index, NeighborType include_neighbors) const
 {
+    etl::vector<IndexType, 8> neighbors;
+    const auto x = static_cast<int>(index % m_width);
+    const auto y = static_cast<int>(index / m_width);
+
+    for (auto mask = include_neighbors == NeighborType::kIgnoreLand ? WaterAround(x, y)
+                                                                   : InsideAround(x, y);
+         mask != 0;
+         mask &= mask - 1)
+    {
+        const auto direction = kNeighborDirections[std::countr_zero(mask)];
+
+        neighbors.push_back(index + direction.dy * static_cast<int>(m_width) + direction.dx);
+    }
+
+    return neighbors;
 }
 
-template <size_t CACHE_SIZE>
-std::span<const IndexType>
-Router<CACHE_SIZE>::CalculateRoute(Point from_point, Point to_point)
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+uint8_t
+Router<CACHE_SIZE, OPEN_SET>::InsideAround(int x, int y) const
 {
-    auto from = PointToLandIndex(from_point, m_width);
-    auto to = PointToLandIndex(to_point, m_width);
+    // Without branches, as it's for every expanded node
+    constexpr uint8_t kLeft = 0b00101001;
+    constexpr uint8_t kRight = 0b10010100;
+    constexpr uint8_t kTop = 0b00000111;
+    constexpr uint8_t kBottom = 0b11100000;
+    const auto outside = (x == 0) * kLeft | (x + 1 == static_cast<int>(m_width)) * kRight |
+                         (y == 0) * kTop | (y + 1 == static_cast<int>(m_height)) * kBottom;
+
+    return static_cast<uint8_t>(~outside);
+}
 
-    return CalculateRoute(from, to);
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+uint8_t
+Router<CACHE_SIZE, OPEN_SET>::WaterAround(int x, int y) const
+{
+    // The 3x3 land bits from three row words (outside the map reads as water, but isn't inside)
+    const auto above = LandBits(x - 1, y - 1);
+    const auto row = LandBits(x - 1, y);
+    const auto below = LandBits(x - 1, y + 1);
+    const auto land = (above & 0b111) | (row & 0b001) << 3 | (row & 0b100) << 2 |
+                      (below & 0b111) << 5;
+
+    return static_cast<uint8_t>(~land) & InsideAround(x, y);
 }
 
-template <size_t CACHE_SIZE>
-std::span<const IndexType>
-Router<CACHE_SIZE>::CalculateRoute(IndexType from, IndexType to)
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+etl::vector<typename Router<CACHE_SIZE, OPEN_SET>::Successor, 8>
+Router<CACHE_SIZE, OPEN_SET>::Successors(const Node* cur, IndexType to, Vector parent_direction)
 {
-    if (!IsWater(m_land_mask, from))
+    if (m_engine == Engine::kJumpPointSearch)
     {
-        from = FindNearestWater(from);
+        return JumpSuccessors(cur, to, parent_direction);
     }
-    if (!IsWater(m_land_mask, to))
+
+    etl::vector<Successor, 8> successors;
+
+    const auto x = static_cast<int>(cur->index % m_width);
+    const auto y = static_cast<int>(cur->index / m_width);
+
+    for (auto mask = WaterAround(x, y); mask != 0; mask &= mask - 1)
     {
-        to = FindNearestWater(to);
+        const auto direction = kNeighborDirections[std::countr_zero(mask)];
+        const auto neighbor_index = cur->index + direction.dy * static_cast<int>(m_width) +
+                                    direction.dx;
+
+        successors.push_back(
+            {neighbor_index, StepCost(neighbor_index, direction, parent_direction)});
     }
 
-    m_stats.Reset();
-    m_result.clear();
+    return successors;
+}
 
-    for (auto i = 0; i < 100; i++)
-    {
-        auto rc = RunAstar(from, to);
-        if (rc == Router::AstarResult::kNoPath)
-        {
-            return {};
-        }
-        else
-        {
-            auto top = kInvalidIndex;
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+etl::vector<typename Router<CACHE_SIZE, OPEN_SET>::Successor, 8>
+Router<CACHE_SIZE, OPEN_SET>::JumpSuccessors(const Node* cur, IndexType to, Vector parent_direction)
+{
+    etl::vector<Vector, 8> directions;
+    etl::vector<Successor, 8> successors;
 
-            // When merging, avoid repeating the end node of the previous path
-            if (!m_result.empty())
-            {
-                top = m_result.back();
-            }
+    const int x = cur->index % m_width;
+    const int y = cur->index / m_width;
 
-            for (auto rit = m_current_result.rbegin(); rit != m_current_result.rend(); ++rit)
+    const auto open_water = OpenWaterAround(x, y);
+
+    if (parent_direction == Vector::Standstill() || open_water != kAllOpenWater)
+    {
+        // At the start, or where there can be forced neighbors: consider all directions
+        for (auto dy = -1; dy <= 1; dy++)
+        {
+            for (auto dx = -1; dx <= 1; dx++)
             {
-                if (*rit == top)
+                if (dx != 0 || dy != 0)
                 {
-                    continue;
+                    directions.push_back(Vector {static_cast<int8_t>(dx), static_cast<int8_t>(dy)});
                 }
-                m_result.push_back(*rit);
-            }
-
-            if (rc == Router::AstarResult::kPathFound)
-            {
-                return m_result;
-            }
-            else
-            {
-                from = m_current_result.front();
             }
-            m_current_result.clear();
         }
+    }
+    else
+    {
+        // Only the natural neighbors in open water
+        directions.push_back(parent_direction);
+        if (parent_direction.IsDiagonal())
+        {
+            directions.push_back(Vector {parent_direction.dx, 0});
+            directions.push_back(Vector {0, parent_direction.dy});
+        }
+    }
 
-        m_stats.partial_paths++;
+    for (auto direction : directions)
+    {
+        if (auto successor = Jump(cur->index, open_water, direction, to, parent_direction);
+            successor)
+        {
+            successors.push_back(*successor);
+        }
     }
 
-    return {};
+    return successors;
 }
 
-template <size_t CACHE_SIZE>
-Router<CACHE_SIZE>::AstarResult
-Router<CACHE_SIZE>::RunAstar(IndexType from, IndexType to)
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+std::optional<typename Router<CACHE_SIZE, OPEN_SET>::Successor>
+Router<CACHE_SIZE, OPEN_SET>::Jump(IndexType from,
+                                   uint16_t open_water,
+                                   Vector direction,
+                                   IndexType to,
+                                   Vector parent_direction)
 {
-    m_current_result.clear();
-    m_open_set.clear();
-    m_nodes.clear();
+    int x = from % m_width;
+    int y = from / m_width;
+    CostType cost = 0;
+
+    // The jump is bounded, except towards the destination which must always be found
+    const auto steps_to_destination = StepsTo(x, y, direction, to);
+    const auto max_distance = steps_to_destination != std::numeric_limits<unsigned>::max()
+                                  ? steps_to_destination
+                                  : kMaxJumpDistance;
+    auto distance = 0u;
+
+    while (true)
+    {
+        if (!direction.IsDiagonal() && open_water == kAllOpenWater)
+        {
+            // Far from land nothing can happen, so skip over those cells quickly
+            const auto run = OpenWaterRun(x, y, direction, max_distance - distance - 1);
 
-    auto p = GetNode(from);
+            for (auto i = 0u; i < run; i++)
+            {
+                cost += BaseCost(direction, parent_direction);
+                parent_direction = direction;
+            }
+            x += direction.dx * static_cast<int>(run);
+            y += direction.dy * static_cast<int>(run);
+            distance += run;
+        }
 
-    p->f = p->g + Heuristic(from, to); /* g+h */
-    p->parent = nullptr;
+        x += direction.dx;
+        y += direction.dy;
+        distance++;
 
-    m_open_set.push(p);
+        if (!IsWaterAt(x, y))
+        {
+            return std::nullopt;
+        }
+        m_stats.cells_scanned++;
 
-    /* While there are nodes in the Open set */
-    while (!m_open_set.empty())
+        const auto index = static_cast<IndexType>(y * m_width + x);
+        open_water = OpenWaterAround(x, y);
+
+        // Near land, the cost varies from cell to cell, so stop jumping there
+        if (index == to || !(open_water & kOpenWaterCenter))
+        {
+            return Successor {index, cost + StepCost(index, direction, parent_direction)};
+        }
+
+        // Open water, so no coast penalty
+        cost += BaseCost(direction, parent_direction);
+        parent_direction = direction;
+
+        // Bound the jump length, the following jumps continue from here
+        if (distance >= max_distance || HasForcedNeighbor(open_water, direction))
+        {
+            return Successor {index, cost};
+        }
+
+        if (direction.IsDiagonal() && (Reaches(x, y, open_water, Vector {direction.dx, 0}, to) ||
+                                       Reaches(x, y, open_water, Vector {0, direction.dy}, to)))
+        {
+            return Successor {index, cost};
+        }
+    }
+
+    // Unreachable
+    return std::nullopt;
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+bool
+Router<CACHE_SIZE, OPEN_SET>::Reaches(
+    int x, int y, uint16_t open_water, Vector direction, IndexType to)
+{
+    // The scan is bounded, except towards the destination which must always be found
+    const auto steps_to_destination = StepsTo(x, y, direction, to);
+    const auto max_distance = steps_to_destination != std::numeric_limits<unsigned>::max()
+                                  ? steps_to_destination
+                                  : kMaxJumpDistance;
+    auto distance = 0u;
+
+    while (distance < max_distance)
     {
-        auto cur = m_open_set.top();
+        const auto run = open_water == kAllOpenWater
+                             ? OpenWaterRun(x, y, direction, max_distance - distance)
+                             : 0;
 
-        m_open_set.pop();
+        if (steps_to_destination - distance <= run)
+        {
+            return true;
+        }
+        x += direction.dx * static_cast<int>(run);
+        y += direction.dy * static_cast<int>(run);
+        distance += run;
 
-        /* We found a path! */
-        if (cur->index == to)
+        if (distance == max_distance)
         {
-            ProduceResult(cur);
+            break;
+        }
 
-            return Router::AstarResult::kPathFound;
+        x += direction.dx;
+        y += direction.dy;
+        distance++;
+
+        if (!IsWaterAt(x, y))
+        {
+            return false;
         }
+        m_stats.cells_scanned++;
 
-        auto parent_direction = Vector::Standstill();
+        if (static_cast<IndexType>(y * m_width + x) == to)
+        {
+            return true;
+        }
 
-        if (cur->parent)
+        open_water = OpenWaterAround(x, y);
+
+        if (!(open_water & kOpenWaterCenter))
         {
-            parent_direction = IndexPairToDirection(cur->parent->index, cur->index, m_width);
+            // Running straight into the coast is only interesting if the destination is ahead
+            return steps_to_destination != std::numeric_limits<unsigned>::max();
         }
 
-        /* Iterate over UP, DOWN, LEFT and RIGHT */
-        for (auto neighbor_index : Neighbors(cur->index, NeighborType::kIgnoreLand))
+        if (HasForcedNeighbor(open_water, direction))
         {
-            auto neighbor_node = GetNode(neighbor_index);
+            return true;
+        }
+    }
 
-            m_stats.nodes_expanded++;
-            if (!neighbor_node)
-            {
-                ProduceResult(cur);
+    // Further away, the jumps from the next jump point will take care of it
+    return false;
+}
 
-                return Router::AstarResult::kMaxNodesReached;
-            }
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+unsigned
+Router<CACHE_SIZE, OPEN_SET>::StepsTo(int x, int y, Vector direction, IndexType to) const
+{
+    const int to_x = to % m_width;
+    const int to_y = to / m_width;
 
-            const auto direction = IndexPairToDirection(cur->index, neighbor_index, m_width);
-            const auto is_diagonal = (neighbor_index % m_width != cur->index % m_width) &&
-                                     (neighbor_index / m_width != cur->index / m_width);
-            auto cost = is_diagonal ? 6 : 4;
+    if (direction.dx == 0 && to_x == x && (to_y - y) * direction.dy > 0)
+    {
+        return std::abs(to_y - y);
+    }
+    if (direction.dy == 0 && to_y == y && (to_x - x) * direction.dx > 0)
+    {
+        return std::abs(to_x - x);
+    }
+
+    return std::numeric_limits<unsigned>::max();
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+unsigned
+Router<CACHE_SIZE, OPEN_SET>::OpenWaterRun(int x, int y, Vector direction, unsigned max_run) const
+{
+    // The number of cells after x,y in a straight direction without land within kClearance cells.
+    // Such cells are open water and can't have forced neighbors. x,y itself must be clear of land
+    // within kClearance cells
+    constexpr auto kClearance = kOpenWaterDistance + 1;
+    constexpr auto kWindow = 2 * kClearance + 1;
+    constexpr auto kCellsPerScan = 32 - kWindow;
+    auto run = 0u;
+
+    if (direction.dy == 0)
+    {
+        // Horizontally, the land bits of all rows are combined and checked many cells at a time
+        while (run < max_run)
+        {
+            const auto cur_x = x + direction.dx * static_cast<int>(run);
+            uint32_t land = 0;
 
-            if (direction == parent_direction)
+            for (auto row = y - kClearance; row <= y + kClearance; row++)
             {
-                // Favor straight lines
-                cost -= 1;
+                land |= LandBits(direction.dx > 0 ? cur_x - kClearance + 1 : cur_x - 32 + kClearance,
+                                 row);
             }
 
-            // If there's land in this direction, add an extra cost to it to keep the path from land
-            if (AdjacentToLand(neighbor_node))
+            auto spread = land;
+            for (auto i = 1; i < kWindow; i++)
             {
-                cost += 8;
+                spread |= direction.dx > 0 ? land >> i : land << i;
             }
-            auto newg = cur->g + cost;
 
-            if ((neighbor_node->IsOpen() || neighbor_node->IsClosed()) && neighbor_node->g <= newg)
+            // countr_zero/countl_zero return 32 for no land at all
+            const auto open = std::min<unsigned>(
+                direction.dx > 0 ? std::countr_zero(spread) : std::countl_zero(spread),
+                kCellsPerScan);
+            run += open;
+            if (open < kCellsPerScan)
             {
-                // We have a better value or this is not valid
-                continue;
+                break;
             }
-
-            neighbor_node->parent = cur;
-            neighbor_node->g = newg;
-            neighbor_node->f = neighbor_node->g + Heuristic(neighbor_index, to); // g+h
-
-            if (!neighbor_node->IsOpen())
+        }
+    }
+    else
+    {
+        // Vertically, one new row per cell
+        for (auto row = y + (kClearance + 1) * direction.dy; run < max_run; row += direction.dy)
+        {
+            if (LandBits(x - kClearance, row) & ((1u << kWindow) - 1))
             {
-                m_open_set.push(neighbor_node);
-                neighbor_node->Open();
+                break;
             }
+            run++;
         }
-
-        cur->Close();
     }
 
-    /* There was no path */
-    return Router::AstarResult::kNoPath;
+    return std::min(run, max_run);
 }
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+bool
+Router<CACHE_SIZE, OPEN_SET>::HasForcedNeighbor(uint16_t open_water, Vector direction) const
+{
+    const auto dx = direction.dx;
+    const auto dy = direction.dy;
 
+    // Cells near land are treated as obstacles, as in regular JPS
+    auto blocked = [open_water](int dx, int dy) {
+        return (open_water & (1 << ((dy + 1) * 3 + dx + 1))) == 0;
+    };
 
-template <size_t CACHE_SIZE>
-Router<CACHE_SIZE>::Node*
-Router<CACHE_SIZE>::GetNode(IndexType index)
-{
-    auto it = m_nodes.find(index);
-    if (it != m_nodes.end())
+    if (direction.IsDiagonal())
     {
-        return &it->second;
+        return (blocked(-dx, 0) && !blocked(-dx, dy)) || (blocked(0, -dy) && !blocked(dx, -dy));
     }
-
-    if (m_nodes.full())
+    if (dy == 0)
     {
-        return nullptr;
+        return (blocked(0, 1) && !blocked(dx, 1)) || (blocked(0, -1) && !blocked(dx, -1));
     }
 
-    auto [insert_it, ok] = m_nodes.insert({index, Node()});
-    if (!ok)
+    return (blocked(1, 0) && !blocked(1, dy)) || (blocked(-1, 0) && !blocked(-1, dy));
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+bool
+Router<CACHE_SIZE, OPEN_SET>::IsWaterAt(int x, int y) const
+{
+    if (x < 0 || y < 0 || x >= static_cast<int>(m_width) || y >= static_cast<int>(m_height))
     {
-        return nullptr;
+        return false;
     }
-    insert_it->second.index = index;
-    return &insert_it->second;
-}
 
+    return IsWater(m_land_mask, y * m_width + x);
+}
 
-template <size_t CACHE_SIZE>
-etl::vector<IndexType, 8>
-Router<CACHE_SIZE>::Neighbors(IndexType index, NeighborType include_neighbors) const
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+uint16_t
+Router<CACHE_SIZE, OPEN_SET>::OpenWaterAround(int x, int y) const
 {
-    etl::vector<IndexType, 8> neighbors;
-
-    auto x = index % m_width;
-    auto y = index / m_width;
+    // Open water is water with no land within kOpenWaterDistance cells, i.e., neither the cell nor
+    // its neighbors get the coast penalty. Bit (dy + 1) * 3 + dx + 1 is set for open water at
+    // x + dx, y + dy
+    constexpr auto kRows = 2 * kOpenWaterDistance + 3;
+    constexpr auto kWindow = (1u << (2 * kOpenWaterDistance + 1)) - 1;
+    std::array<uint32_t, kRows> rows;
+    uint16_t out = 0;
+
+    for (auto i = 0; i < kRows; i++)
+    {
+        rows[i] = LandBits(x - kOpenWaterDistance - 1, y - kOpenWaterDistance - 1 + i) &
+                  ((1u << kRows) - 1);
+    }
 
     for (auto dy = -1; dy <= 1; dy++)
     {
+        uint32_t land = 0;
+        for (auto i = dy + 1; i <= dy + 1 + 2 * kOpenWaterDistance; i++)
+        {
+            land |= rows[i];
+        }
+
         for (auto dx = -1; dx <= 1; dx++)
         {
-            if (dx == 0 && dy == 0)
+            if (((land >> (dx + 1)) & kWindow) == 0)
             {
-                // Skip self
-                continue;
+                out |= 1 << ((dy + 1) * 3 + dx + 1);
             }
+        }
+    }
 
-            auto nx = x + dx;
-            auto ny = y + dy;
+    return out;
+}
 
-            if (nx < 0 || nx >= m_width || ny < 0 || ny >= m_height)
-            {
-                continue;
-            }
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+uint32_t
+Router<CACHE_SIZE, OPEN_SET>::LandBits(int x, int y) const
+{
+    // 32 cells of land bits from x,y onwards. As for the land penalty, outside the map doesn't
+    // count as land (the jumps stop at the map edges anyway)
+    if (y < 0 || y >= static_cast<int>(m_height) || x <= -32 || x >= static_cast<int>(m_width))
+    {
+        return 0;
+    }
 
-            auto neighbor = ny * m_width + nx;
-            if (include_neighbors == NeighborType::kIgnoreLand)
-            {
-                if (IsWater(m_land_mask, neighbor))
-                {
-                    neighbors.push_back(neighbor);
-                }
-            }
-            else
-            {
-                neighbors.push_back(neighbor);
-            }
-        }
+    uint32_t inside = 0xffffffff;
+    auto start = x;
+
+    if (x < 0)
+    {
+        inside <<= -x;
+        start = 0;
+    }
+    if (x + 32 > static_cast<int>(m_width))
+    {
+        inside &= ~(0xffffffff << (m_width - x));
     }
 
-    return neighbors;
+    const auto bits = static_cast<uint64_t>(m_land_mask.RowBits(start, y)) << (start - x);
+
+    return static_cast<uint32_t>(bits) & inside;
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+CostType
+Router<CACHE_SIZE, OPEN_SET>::BaseCost(Vector direction, Vector parent_direction) const
+{
+    CostType cost = direction.IsDiagonal() ? 6 : 4;
+
+    if (direction == parent_direction)
+    {
+        // Favor straight lines
+        cost -= 1;
+    }
+
+    return cost;
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+CostType
+Router<CACHE_SIZE, OPEN_SET>::StepCost(IndexType to,
+                                       Vector direction,
+                                       Vector parent_direction) const
+{
+    return BaseCost(direction, parent_direction) + LandPenalty(to);
 }
 
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+CostType
+Router<CACHE_SIZE, OPEN_SET>::LandPenalty(IndexType index) const
+{
+    // The closer to land, the more expensive, to keep the path away from it
+    return kCoastPenalty[CoastDistance(index)];
+}
 
-template <size_t CACHE_SIZE>
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
 CostType
-Router<CACHE_SIZE>::Heuristic(IndexType from, IndexType to)
+Router<CACHE_SIZE, OPEN_SET>::Heuristic(IndexType from, IndexType to)
 {
     int from_x = from % m_width;
     int from_y = from / m_width;
@@ -264,63 +2076,131 @@ Router<CACHE_SIZE>::Heuristic(IndexType from, IndexType to)
     const auto D2 = 3;
     const auto dx = std::abs(from_x - to_x);
     const auto dy = std::abs(from_y - to_y);
+    CostType h = D * (dx + dy) + (D2 - 2 * D) * std::min(dx, dy);
 
-    return D * (dx + dy) + (D2 - 2 * D) * std::min(dx, dy);
-}
+    if (to == m_landmark_target && !m_target_landmarks.empty())
+    {
+        // With the cheapest (straight on) step costs, which is tighter than the above
+        const CostType cheapest = 3 * std::max(dx, dy) + 2 * std::min(dx, dy);
 
-template <size_t CACHE_SIZE>
-bool
-Router<CACHE_SIZE>::AdjacentToLand(const Node* node) const
-{
-    for (auto neighbor_index : Neighbors(node->index, NeighborType::kAll))
+        h = std::max(cheapest, LandmarkHeuristic(from));
+    }
+    else if (m_engine == Engine::kBidirectional)
     {
-        if (!IsWater(m_land_mask, neighbor_index))
-        {
-            return true;
-        }
+        // The frontiers only meet early when both are drawn towards each other
+        h = 3 * std::max(dx, dy) + 2 * std::min(dx, dy);
     }
 
-    return false;
+    return m_heuristic_weight == 100 ? h : h * m_heuristic_weight / 100;
 }
 
-template <size_t CACHE_SIZE>
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
 IndexType
-Router<CACHE_SIZE>::FindNearestWater(IndexType from) const
+Router<CACHE_SIZE, OPEN_SET>::FindNearestWater(IndexType from, uint16_t component) const
 {
-    constexpr auto kLimit = 16;
-    auto point = LandIndexToPoint(from, m_width);
+    const auto from_x = static_cast<int>(from % m_width);
+    const auto from_y = static_cast<int>(from / m_width);
+    const auto height = static_cast<int>(m_height);
+    auto best = from;
+    auto best_distance = std::numeric_limits<unsigned>::max();
+
+    if (component != kUnknownComponent)
+    {
+        // Only a bit further than the closest water, or the point is rather on another body of
+        // water
+        const auto closest = FindNearestWater(from);
+        const auto slack = CellDistance(from, closest) + kReachableWaterSlack;
+
+        best_distance = slack * slack + 1;
+    }
+
+    auto matches = [component](const WaterRun& run) {
+        return component == kUnknownComponent || run.component == component;
+    };
+    // Squared, for the exact closest cell
+    auto consider = [&](int x, int y) {
+        const auto distance =
+            static_cast<unsigned>((x - from_x) * (x - from_x) + (y - from_y) * (y - from_y));
+        if (distance < best_distance)
+        {
+            best = y * m_width + x;
+            best_distance = distance;
+        }
+    };
+    auto within = [&](int x, int y) {
+        return static_cast<unsigned>((x - from_x) * (x - from_x) + (y - from_y) * (y - from_y)) <
+               best_distance;
+    };
+    // The first water cell from x onwards, which must be there
+    auto first_water = [this](int x, int y) {
+        for (;; x += 32)
+        {
+            if (const auto water = ~LandBits(x, y); water != 0)
+            {
+                return x + std::countr_zero(water);
+            }
+        }
+    };
 
-    // Find land
-    for (auto dx = 0; dx < kLimit; dx++)
+    // The closest water on each side in the rows around, until they are further away than the
+    // best so far. The water runs give the left sides directly
+    for (auto dy = 0; static_cast<unsigned>(dy * dy) < best_distance &&
+                      (from_y - dy >= 0 || from_y + dy < height);
+         dy++)
     {
-        for (auto dy = 0; dy < kLimit; dy++)
+        for (auto side = 0; side < (dy == 0 ? 1 : 2); side++)
         {
-            auto nx = point.x + dx * kPathFinderTileSize;
-            auto ny = point.y + dy * kPathFinderTileSize;
+            const auto y = side == 0 ? from_y - dy : from_y + dy;
+
+            if (y < 0 || y >= height)
+            {
+                continue;
+            }
+
+            const auto first = m_water_runs.begin() + m_water_row_start[y];
+            const auto last = m_water_runs.begin() + m_water_row_start[y + 1];
+            const auto run = std::lower_bound(first, last, from_x, [](const WaterRun& r, int x) {
+                return r.last_x < x;
+            });
+            const auto on_run = run != last && IsWater(m_land_mask, y * m_width + from_x);
 
-            auto bx = point.x - dx * kPathFinderTileSize;
-            auto by = point.y - dy * kPathFinderTileSize;
+            if (on_run && matches(*run))
+            {
+                consider(from_x, y);
+                continue;
+            }
 
-            auto neighbor = PointToLandIndex({nx, ny}, m_width);
-            auto below_neighbor = PointToLandIndex({bx, by}, m_width);
-            if (IsWater(m_land_mask, neighbor))
+            for (auto left = run; left != first && within(std::prev(left)->last_x, y); left--)
             {
-                return neighbor;
+                if (matches(*std::prev(left)))
+                {
+                    consider(std::prev(left)->last_x, y);
+                    break;
+                }
             }
-            if (IsWater(m_land_mask, below_neighbor))
+
+            // Past the run from_x is on, if any
+            auto x = on_run ? run->last_x + 1 : from_x;
+            for (auto right = on_run ? run + 1 : run; right != last && within(x + 1, y); right++)
             {
-                return below_neighbor;
+                x = first_water(x + 1, y);
+                if (matches(*right))
+                {
+                    consider(x, y);
+                    break;
+                }
+                x = right->last_x + 1;
             }
         }
     }
 
-    // Give up
-    return from;
+    // from itself when there is no water (in the component)
+    return best;
 }
 
-template <size_t CACHE_SIZE>
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
 void
-Router<CACHE_SIZE>::ProduceResult(const Node* cur)
+Router<CACHE_SIZE, OPEN_SET>::ProduceResult(const Node* cur)
 {
     auto last_direction = Vector::Standstill();
 
@@ -348,12 +2228,47 @@ Router<CACHE_SIZE>::ProduceResult(const Node* cur)
     }
 }
 
-template <size_t CACHE_SIZE>
-Router<CACHE_SIZE>::Stats
-Router<CACHE_SIZE>::GetStats() const
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+Router<CACHE_SIZE, OPEN_SET>::Stats
+Router<CACHE_SIZE, OPEN_SET>::GetStats() const
+{
+    auto out = m_stats;
+
+    // Both directions for the bidirectional search
+    out.open_set_high_water = m_open_set.HighWater();
+    if (m_backward_open_set)
+    {
+        out.open_set_high_water += m_backward_open_set->HighWater();
+    }
+
+    return out;
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+size_t
+Router<CACHE_SIZE, OPEN_SET>::SearchMemory() const
+{
+    const auto stats = GetStats();
+
+    return stats.nodes_used * sizeof(Node) +
+           stats.open_set_high_water * OPEN_SET<Node*, CACHE_SIZE>::EntrySize();
+}
+
+template <size_t CACHE_SIZE, template <typename, size_t> class OPEN_SET>
+const char*
+Router<CACHE_SIZE, OPEN_SET>::HeuristicName() const
 {
-    return m_stats;
+    // As Heuristic()
+    if (m_landmarks)
+    {
+        return "cheapest step diagonal distance, with landmarks";
+    }
+
+    return m_engine == Engine::kBidirectional ? "cheapest step diagonal distance"
+                                              : "diagonal distance";
 }
 
 template class Router<kTargetCacheSize>;
 template class Router<kUnitTestCacheSize>;
+template class Router<kUnitTestTinyCacheSize>;
+template class Router<kMapBuilderCacheSize>;
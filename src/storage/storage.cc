@@ -85,10 +85,10 @@ Storage::OnActivation()
     std::optional<IndexType> new_route_destination;
     while (auto route = m_route_listener->Poll())
     {
-        if (route->type == IRouteListener::EventType::kReady && route->route.size() > 1 &&
+        if (route->type == IRouteListener::EventType::kReady && route->route.Span().size() > 1 &&
             current_state->demo_mode == false)
         {
-            new_route_destination = route->route.back();
+            new_route_destination = route->route.Span().back();
         }
     }
 
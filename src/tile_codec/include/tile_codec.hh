@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// "RLET"
+constexpr uint32_t kRleTileMagic = 0x54454C52;
+
+// A tile as run-length encoded palette indices (written by tiler.py), which decodes much faster
+// than a PNG. Little endian:
+//
+//   uint32_t magic
+//   uint16_t width, height
+//   uint16_t palette size, followed by the palette as RGB565
+//   The indices, row after row, as runs. A byte n < 128 is followed by n + 1 indices, and a byte
+//   n >= 128 by one index repeated n - 125 times
+bool IsRleTile(std::span<const uint8_t> data);
+
+// The palette and the indices (width * height of them) of an RLE tile, false if it's broken
+bool DecodeRleTile(std::span<const uint8_t> data,
+                   std::span<uint16_t> palette,
+                   std::span<uint8_t> indices);
+
+// As tiler.py does it
+std::vector<uint8_t> EncodeRleTile(uint16_t width,
+                                   uint16_t height,
+                                   std::span<const uint16_t> palette,
+                                   std::span<const uint8_t> indices);
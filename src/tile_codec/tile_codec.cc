@@ -0,0 +1,160 @@
+#include "tile_codec.hh"
+
+#include <algorithm>
+
+constexpr auto kHeaderSize = 10;
+constexpr auto kMaxLiterals = 128;
+constexpr auto kMinRun = 3;
+constexpr auto kMaxRun = 130;
+
+namespace
+{
+
+uint16_t
+Read16(std::span<const uint8_t> data, size_t offset)
+{
+    return data[offset] | (data[offset + 1] << 8);
+}
+
+void
+Write16(std::vector<uint8_t>& out, uint16_t value)
+{
+    out.push_back(value & 0xff);
+    out.push_back(value >> 8);
+}
+
+void
+FlushLiterals(std::vector<uint8_t>& out, std::span<const uint8_t> literals)
+{
+    if (!literals.empty())
+    {
+        out.push_back(literals.size() - 1);
+        out.insert(out.end(), literals.begin(), literals.end());
+    }
+}
+
+} // namespace
+
+bool
+IsRleTile(std::span<const uint8_t> data)
+{
+    return data.size() >= kHeaderSize &&
+           (Read16(data, 0) | (Read16(data, 2) << 16)) == kRleTileMagic;
+}
+
+bool
+DecodeRleTile(std::span<const uint8_t> data,
+              std::span<uint16_t> palette,
+              std::span<uint8_t> indices)
+{
+    if (!IsRleTile(data))
+    {
+        return false;
+    }
+
+    const auto width = Read16(data, 4);
+    const auto height = Read16(data, 6);
+    const auto palette_size = Read16(data, 8);
+
+    if (width * height != indices.size() || palette_size > palette.size() ||
+        data.size() < kHeaderSize + palette_size * sizeof(uint16_t))
+    {
+        return false;
+    }
+
+    for (auto i = 0u; i < palette_size; i++)
+    {
+        palette[i] = Read16(data, kHeaderSize + i * sizeof(uint16_t));
+    }
+
+    auto in = kHeaderSize + palette_size * sizeof(uint16_t);
+    auto out = 0u;
+
+    while (out < indices.size())
+    {
+        if (in >= data.size())
+        {
+            return false;
+        }
+
+        const auto control = data[in++];
+
+        if (control < kMaxLiterals)
+        {
+            const auto count = control + 1u;
+
+            if (in + count > data.size() || out + count > indices.size())
+            {
+                return false;
+            }
+            std::copy_n(&data[in], count, &indices[out]);
+            in += count;
+            out += count;
+        }
+        else
+        {
+            const auto count = control - kMaxLiterals + kMinRun;
+
+            if (in >= data.size() || out + count > indices.size())
+            {
+                return false;
+            }
+            std::fill_n(&indices[out], count, data[in++]);
+            out += count;
+        }
+    }
+
+    return true;
+}
+
+std::vector<uint8_t>
+EncodeRleTile(uint16_t width,
+              uint16_t height,
+              std::span<const uint16_t> palette,
+              std::span<const uint8_t> indices)
+{
+    std::vector<uint8_t> out;
+
+    Write16(out, kRleTileMagic & 0xffff);
+    Write16(out, kRleTileMagic >> 16);
+    Write16(out, width);
+    Write16(out, height);
+    Write16(out, palette.size());
+    for (auto color : palette)
+    {
+        Write16(out, color);
+    }
+
+    auto literals_start = 0u;
+    auto i = 0u;
+
+    while (i < indices.size())
+    {
+        auto run = 1u;
+        while (i + run < indices.size() && run < kMaxRun && indices[i + run] == indices[i])
+        {
+            run++;
+        }
+
+        if (run >= kMinRun)
+        {
+            FlushLiterals(out, indices.subspan(literals_start, i - literals_start));
+            out.push_back(run - kMinRun + kMaxLiterals);
+            out.push_back(indices[i]);
+            i += run;
+            literals_start = i;
+        }
+        else
+        {
+            i++;
+            if (i - literals_start == kMaxLiterals)
+            {
+                FlushLiterals(out, indices.subspan(literals_start, kMaxLiterals));
+                literals_start = i;
+            }
+        }
+    }
+    FlushLiterals(out, indices.subspan(literals_start, i - literals_start));
+
+    return out;
+}
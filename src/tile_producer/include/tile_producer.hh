@@ -2,29 +2,72 @@
 
 #include "application_state.hh"
 #include "base_thread.hh"
+#include "gps_port.hh"
 #include "hal/i_display.hh"
 #include "image.hh"
+#include "painter.hh"
 #include "tile.hh"
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <etl/deque.h>
 #include <etl/list.h>
 #include <etl/mutex.h>
-#include <etl/queue_spsc_atomic.h>
 #include <etl/vector.h>
 #include <memory>
 #include <vector>
 
-// Cache all visible tiles, plus a few for good measure
-constexpr auto kTileCacheSize =
-    2 + ((hal::kDisplayWidth / kTileSize) + 1) * ((hal::kDisplayHeight / kTileSize) + 1);
+// Keep decoded tiles as palette indices (tiler.py makes 64 color palette PNGs), at half the
+// memory of RGB565. The color mode is then applied when drawing, so switching it is instant
+constexpr auto kPaletteTiles = true;
+
+// Cache all visible tiles, plus a few for good measure. Twice as many as palette tiles, in the
+// memory of the RGB565 ones (doc/ram.md)
+constexpr auto kTileCacheSize = std::min(
+    32,
+    (kPaletteTiles ? 2 : 1) *
+        (2 + ((hal::kDisplayWidth / kTileSize) + 1) * ((hal::kDisplayHeight / kTileSize) + 1)));
 static_assert(kTileCacheSize <= 32); // For the uint32_t atomic
 
+// The most tiles in view at once
+constexpr auto kVisibleTiles =
+    ((hal::kDisplayWidth - 1) / kTileSize + 2) * ((hal::kDisplayHeight - 1) / kTileSize + 2);
+static_assert(kTileCacheSize >= kVisibleTiles);
+
+// Tiles decoded ahead of the boat, up to a view of them. They only take the cache entries beyond
+// the visible tiles, which leave room for them with palette tiles. Without, there is no prefetch
+constexpr size_t kPrefetchTiles = kTileCacheSize >= 2 * kVisibleTiles ? kVisibleTiles : 0;
+
+// The palette of a tile, as RGB565
+using TilePalette = std::array<uint16_t, 256>;
+
+using TileImage = std::conditional_t<kPaletteTiles, painter::IndexedImage, Image>;
+
 class ITileHandle
 {
 public:
     virtual ~ITileHandle() = default;
 
-    virtual const Image& GetImage() const = 0;
+    // In the color mode when locked
+    virtual const TileImage& GetImage() const = 0;
+};
+
+enum class TileState
+{
+    kReady,
+    kPending,
+    kMissing,
+
+    kValueCount,
+};
+
+// A tile looked up without waiting for it to be decoded
+struct TileLookup
+{
+    TileState state;
+    // Only for kReady
+    std::unique_ptr<ITileHandle> tile;
 };
 
 class ImageImpl : public Image
@@ -44,24 +87,100 @@ public:
     std::array<uint8_t, kTileSize * kTileSize * sizeof(uint16_t)> rgb565_data;
 };
 
+class IndexedImageImpl
+{
+public:
+    explicit IndexedImageImpl(unsigned index)
+        : index(index)
+    {
+    }
+
+    unsigned int index;
+    std::array<uint8_t, kTileSize * kTileSize> indices;
+    TilePalette palette;
+};
+
+using TileImpl = std::conditional_t<kPaletteTiles, IndexedImageImpl, ImageImpl>;
+
 class TileProducer : public os::BaseThread
 {
 public:
-    TileProducer(ApplicationState& application_state, const MapMetadata& flash_tile_data);
+    // With workers, tiles are also decoded on threads of their own, in parallel
+    TileProducer(ApplicationState& application_state,
+                 const MapMetadata& flash_tile_data,
+                 unsigned workers = 0);
 
-    // Context: Another thread
+    ~TileProducer() override;
+
+    // Decode the tiles coming into view ahead of the boat, from its heading and speed (before
+    // Start())
+    void AttachGpsPort(std::unique_ptr<IGpsPort> gps_port);
+
+    // Released when a tile asked for with TryLockTile has been decoded (before Start())
+    void AwakeOnTiles(os::binary_semaphore& semaphore);
+
+    // Context: Another thread. Blocks while the tile is decoded
     std::unique_ptr<ITileHandle> LockTile(const Point& point);
 
+    // Context: Another thread. Never blocks: pending tiles are decoded in the background, and
+    // those which fail to decode are missing from then on
+    TileLookup TryLockTile(const Point& point);
+
     bool IsCached(const Point& point) const;
 
 private:
+    class Worker;
+
+    using TileIndices = etl::vector<uint32_t, kVisibleTiles>;
+
+    enum class DecodeKind
+    {
+        // Waited for by LockTile
+        kRequested,
+        // From TryLockTile
+        kPending,
+        kPrefetch,
+    };
+
+    // One tile being decoded, by this thread or a worker
+    struct DecodeJob
+    {
+        uint32_t index;
+        DecodeKind kind;
+        ApplicationState::ColorMode color_mode;
+        unsigned generation;
+    };
+
+    void OnStartup() final;
+
     std::optional<milliseconds> OnActivation() final;
 
-    std::unique_ptr<ImageImpl> DecodeTile(unsigned index);
+    std::unique_ptr<TileImpl> DecodeTile(unsigned index, ApplicationState::ColorMode color_mode);
 
-    bool CacheTile(unsigned index);
+    // Under m_mutex. The most urgent tile not cached or being decoded
+    std::optional<DecodeJob> ClaimJob();
+
+    // Context: This thread or a worker. Decode a claimed tile into the cache, false if there
+    // was none
+    bool RunJob();
+
+    // Under m_mutex. Prefetched tiles only into a free cache entry, or in place of one neither in
+    // view nor locked
+    bool InsertTile(const DecodeJob& job, std::unique_ptr<TileImpl> tile);
+
+    // Queue the tiles which the view will move onto
+    void PredictTiles(const GpsData& position);
+
+    // The tiles in view with the boat at the center
+    TileIndices TilesAround(const Point& center) const;
+
+    // Under m_mutex. A tile asked for by the UI, which is taken as in view
+    void NoteVisibleTile(uint32_t index);
 
     uint8_t EvictTile();
+
+    std::optional<uint8_t> EvictTileOutside(const TileIndices& visible);
+
     std::optional<unsigned> PointToTileIndex(const Point& point) const;
 
     const uint8_t* m_flash_start;
@@ -69,22 +188,42 @@ private:
     const uint32_t m_tile_count;
     const uint32_t m_tile_row_size;
     const uint32_t m_tile_rows;
+    const TileCodec m_tile_codec;
 
     ApplicationState &m_application_state;
     std::unique_ptr<ApplicationState::IListener> m_state_listener;
 
-    etl::vector<std::unique_ptr<ImageImpl>, kTileCacheSize> m_tiles;
+    etl::vector<std::unique_ptr<TileImpl>, kTileCacheSize> m_tiles;
     etl::list<uint32_t, kTileCacheSize> m_tile_request_order;
     std::atomic<uint32_t> m_locked_cache_entries {0};
     std::vector<uint8_t> m_tile_index_to_cache;
 
-    etl::queue_spsc_atomic<uint32_t, kTileCacheSize> m_tile_requests;
+    // The decoding is shared with the workers, under m_mutex
+    etl::deque<uint32_t, kTileCacheSize> m_tile_requests;
     os::binary_semaphore m_tile_request_semaphore {0};
+    etl::vector<uint32_t, kTileCacheSize> m_decoding;
+    // Changed with the color mode, to drop the tiles decoded in the old one
+    unsigned m_cache_generation {0};
+
+    // From TryLockTile, oldest first. Under m_mutex
+    etl::vector<uint32_t, kTileCacheSize> m_pending_tiles;
+    // Tiles which can't be decoded, reported as missing instead of being tried again. Under m_mutex
+    std::vector<bool> m_failed_tiles;
+    os::binary_semaphore* m_pending_tile_semaphore {nullptr};
 
     // Invalid to start with
     ApplicationState::ColorMode m_color_mode {ApplicationState::ColorMode::kValueCount};
 
+    std::unique_ptr<IGpsPort> m_gps_port;
+    // The tiles most recently asked for with LockTile/TryLockTile, i.e., those the UI last drew,
+    // least recent first. Under m_mutex
+    TileIndices m_visible_tiles;
+    // Speculative, and at most kPrefetchTiles of them
+    TileIndices m_prefetch_tiles;
+
     mutable etl::mutex m_mutex;
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
 };
 
 std::unique_ptr<Image> DecodePng(std::span<const uint8_t> data,
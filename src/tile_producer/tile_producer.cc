@@ -1,12 +1,21 @@
 #include "tile_producer.hh"
 
 #include "hal/i_display.hh"
+#include "tile_codec.hh"
 
 #include <PNGdec.h>
+#include <algorithm>
+#include <cmath>
 #include <mutex>
+#include <numbers>
+#include <type_traits>
 
 constexpr auto kInvalidTileIndex = kTileCacheSize;
 
+// Prefetch when moving at least this fast (knots), and two tiles ahead from kFastSpeed
+constexpr auto kMinPrefetchSpeed = 1.0f;
+constexpr auto kFastSpeed = 10.0f;
+
 namespace
 {
 
@@ -121,6 +130,29 @@ PngDrawMask(PNGDRAW* pDraw)
     }
 }
 
+// r: 254, g: 242, b: 203 in rgb565 (after pillow + png conversion). TODO: Don't hardcode
+constexpr uint16_t kLandColor = 0xff99;
+
+uint16_t
+ToGrayscale(uint16_t pixel)
+{
+    // https://stackoverflow.com/a/71086522, rgb565 to grayscale
+    auto r = (pixel >> 10) & 0x3E; // 6-bit Red Component
+    auto g = (pixel >> 5) & 0x3F;  // 6-bit Green Component
+    auto b = (pixel << 1) & 0x3E;  // 6-bit Blue Component
+
+    auto luma = (r * 218) + (g * 732) + (b * 74); // Wx*1024/10000.
+    luma = (luma >> 10) + ((luma >> 9) & 1);      // 6-bit Luminance value.
+
+    return ((luma & 0x3E) << 10) | (luma << 5) | (luma >> 1);
+}
+
+uint16_t
+LandSlantColor(ApplicationState::ColorMode color_mode)
+{
+    return color_mode == ApplicationState::ColorMode::kBlackRed ? 0xf800 : 0x0000;
+}
+
 void
 PngDrawGrayscale(PNGDRAW* pDraw)
 {
@@ -129,24 +161,11 @@ PngDrawGrayscale(PNGDRAW* pDraw)
     helper->png.getLineAsRGB565(
         pDraw, helper->line_buffer.get(), PNG_RGB565_LITTLE_ENDIAN, 0xffffffff);
 
-
-    // r: 254, g: 242, b: 203 in rgb565 (after pillow + png conversion). TODO: Don't hardcode
-    const uint16_t kLandColor = 0xff99;
-
     const auto y = helper->line_number;
     for (auto x = 0; x < pDraw->iWidth; x++)
     {
         const auto pixel = helper->line_buffer[x];
-
-        // https://stackoverflow.com/a/71086522, rgb565 to grayscale
-        auto r = (pixel >> 10) & 0x3E; // 6-bit Red Component
-        auto g = (pixel >> 5) & 0x3F;  // 6-bit Green Component
-        auto b = (pixel << 1) & 0x3E;  // 6-bit Blue Component
-
-        auto luma = (r * 218) + (g * 732) + (b * 74); // Wx*1024/10000.
-        luma = (luma >> 10) + ((luma >> 9) & 1);      // 6-bit Luminance value.
-
-        auto color = ((luma & 0x3E) << 10) | (luma << 5) | (luma >> 1);
+        auto color = ToGrayscale(pixel);
 
         // Right-slant the land color
         if (pixel == kLandColor && (x + y) % 6 < 2)
@@ -160,13 +179,194 @@ PngDrawGrayscale(PNGDRAW* pDraw)
     helper->line_number++;
 }
 
+void
+PngDrawIndexed(PNGDRAW* pDraw)
+{
+    auto image = static_cast<IndexedImageImpl*>(pDraw->pUser);
+
+    if (pDraw->y == 0)
+    {
+        // RGB888 to RGB565, as getLineAsRGB565 does it
+        for (auto i = 0u; i < image->palette.size(); i++)
+        {
+            const auto rgb = &pDraw->pPalette[i * 3];
+
+            image->palette[i] = ((rgb[0] & 0xf8) << 8) | ((rgb[1] & 0xfc) << 3) | (rgb[2] >> 3);
+        }
+    }
+
+    // 1, 2, 4 or 8 bits per pixel, the leftmost in the high bits
+    const auto bpp = pDraw->iBpp;
+    const auto mask = (1 << bpp) - 1;
+    const auto dst = &image->indices[pDraw->y * pDraw->iWidth];
+
+    for (auto x = 0; x < pDraw->iWidth; x++)
+    {
+        const auto bit = x * bpp;
+
+        dst[x] = (pDraw->pPixels[bit / 8] >> (8 - bpp - bit % 8)) & mask;
+    }
+}
+
+// The palette of the color mode, with the land color slanted on the stripes
+std::span<const uint16_t>
+RemapPalette(const TilePalette& palette,
+             ApplicationState::ColorMode color_mode,
+             bool stripes,
+             TilePalette& out)
+{
+    if (color_mode == ApplicationState::ColorMode::kColor)
+    {
+        return palette;
+    }
+
+    for (auto i = 0u; i < palette.size(); i++)
+    {
+        out[i] = stripes && palette[i] == kLandColor ? LandSlantColor(color_mode)
+                                                     : ToGrayscale(palette[i]);
+    }
+
+    return out;
+}
+
+// Templates, since only the functions for the tiles of kPaletteTiles are used
+template <typename Tile>
+int
+DecodeInto(PNG& png,
+           uint8_t* data,
+           size_t size,
+           Tile& image,
+           ApplicationState::ColorMode color_mode)
+{
+    int rc;
+
+    if constexpr (std::is_same_v<Tile, IndexedImageImpl>)
+    {
+        // The color mode is applied when drawing
+        rc = png.openFLASH(data, size, PngDrawIndexed);
+
+        if (rc != PNG_SUCCESS)
+        {
+            return rc;
+        }
+
+        if (png.getPixelType() == PNG_PIXEL_INDEXED && png.getWidth() == kTileSize &&
+            png.getHeight() == kTileSize)
+        {
+            rc = png.decode(&image, 0);
+        }
+        else
+        {
+            // Not from tiler.py
+            rc = PNG_UNSUPPORTED_FEATURE;
+        }
+    }
+    else
+    {
+        if (color_mode == ApplicationState::ColorMode::kColor)
+        {
+            rc = png.openFLASH(data, size, PngDraw);
+        }
+        else
+        {
+            rc = png.openFLASH(data, size, PngDrawGrayscale);
+        }
+
+        if (rc != PNG_SUCCESS)
+        {
+            return rc;
+        }
+
+        if (color_mode == ApplicationState::ColorMode::kColor)
+        {
+            DecodeHelper priv(png, reinterpret_cast<uint16_t*>(image.rgb565_data.data()));
+            rc = png.decode((void*)&priv, 0);
+        }
+        else
+        {
+            DecodeHelperGrayscale priv(png,
+                                       reinterpret_cast<uint16_t*>(image.rgb565_data.data()),
+                                       LandSlantColor(color_mode));
+
+            rc = png.decode((void*)&priv, 0);
+        }
+    }
+    png.close();
+
+    return rc;
+}
+
+// Straight from flash
+template <typename Tile>
+bool
+DecodeRleInto(std::span<const uint8_t> data, Tile& image, ApplicationState::ColorMode color_mode)
+{
+    if constexpr (std::is_same_v<Tile, IndexedImageImpl>)
+    {
+        return DecodeRleTile(data, image.palette, image.indices);
+    }
+    else
+    {
+        constexpr auto kPixels = kTileSize * kTileSize;
+
+        // The indices into the second half of the RGB565 data, to be expanded from the front.
+        // Each index is read before its bytes are written over
+        auto indices = std::span(image.rgb565_data).subspan(kPixels);
+        TilePalette tile_palette {};
+
+        if (!DecodeRleTile(data, tile_palette, indices))
+        {
+            return false;
+        }
+
+        TilePalette palette;
+        TilePalette stripe_palette;
+        const auto colors = RemapPalette(tile_palette, color_mode, false, palette);
+        const auto stripe_colors = RemapPalette(tile_palette, color_mode, true, stripe_palette);
+        auto dst = reinterpret_cast<uint16_t*>(image.rgb565_data.data());
+
+        for (auto i = 0; i < kPixels; i++)
+        {
+            const auto x = i % kTileSize;
+            const auto y = i / kTileSize;
+
+            dst[i] = ((x + y) % 6 < 2 ? stripe_colors : colors)[indices[i]];
+        }
+
+        return true;
+    }
+}
+
+template <typename Tile>
+TileImage
+MakeImage(const Tile& tile,
+          ApplicationState::ColorMode color_mode,
+          TilePalette& palette,
+          TilePalette& stripe_palette)
+{
+    if constexpr (std::is_same_v<Tile, IndexedImageImpl>)
+    {
+        return painter::IndexedImage(tile.indices,
+                                     kTileSize,
+                                     kTileSize,
+                                     RemapPalette(tile.palette, color_mode, false, palette),
+                                     RemapPalette(tile.palette, color_mode, true, stripe_palette));
+    }
+    else
+    {
+        // Decoded in the color mode
+        return tile;
+    }
+}
+
 class TileHandle : public ITileHandle
 {
 public:
-    explicit TileHandle(ImageImpl& image,
+    explicit TileHandle(const TileImpl& tile,
+                        ApplicationState::ColorMode color_mode,
                         uint8_t cache_index,
                         std::atomic<uint32_t>& locked_cache_entries)
-        : m_image(image)
+        : m_image(MakeImage(tile, color_mode, m_palette, m_stripe_palette))
         , m_cache_index(cache_index)
         , m_locked_cache_entries(locked_cache_entries)
     {
@@ -179,13 +379,16 @@ public:
         m_locked_cache_entries &= ~(1 << m_cache_index);
     }
 
-    const Image& GetImage() const final
+    const TileImage& GetImage() const final
     {
         return m_image;
     }
 
 private:
-    ImageImpl& m_image;
+    // For palette tiles in the grayscale modes
+    TilePalette m_palette;
+    TilePalette m_stripe_palette;
+    TileImage m_image;
     const uint8_t m_cache_index;
     std::atomic<uint32_t>& m_locked_cache_entries;
 };
@@ -193,13 +396,39 @@ private:
 } // namespace
 
 
-TileProducer::TileProducer(ApplicationState& application_state, const MapMetadata& map_metadata)
+class TileProducer::Worker : public os::BaseThread
+{
+public:
+    explicit Worker(TileProducer& parent)
+        : m_parent(parent)
+    {
+    }
+
+private:
+    std::optional<milliseconds> OnActivation() final
+    {
+        if (m_parent.RunJob())
+        {
+            return 0ms;
+        }
+
+        return std::nullopt;
+    }
+
+    TileProducer& m_parent;
+};
+
+
+TileProducer::TileProducer(ApplicationState& application_state,
+                           const MapMetadata& map_metadata,
+                           unsigned workers)
     : m_flash_start(reinterpret_cast<const uint8_t*>(&map_metadata))
     , m_flash_tile_data(
           reinterpret_cast<const FlashTile*>(m_flash_start + map_metadata.tile_data_offset))
     , m_tile_count(map_metadata.tile_count)
     , m_tile_row_size(map_metadata.tile_row_size)
     , m_tile_rows(map_metadata.tile_rows)
+    , m_tile_codec(map_metadata.tile_codec)
     , m_application_state(application_state)
     , m_state_listener(application_state.AttachListener(GetSemaphore()))
 {
@@ -207,10 +436,43 @@ TileProducer::TileProducer(ApplicationState& application_state, const MapMetadat
     assert(m_tile_count == m_tile_row_size * m_tile_rows + 1);
 
     m_tile_index_to_cache.resize(m_tile_count);
+    m_failed_tiles.resize(m_tile_count);
 
     std::ranges::fill(m_tile_index_to_cache, kInvalidTileIndex);
+
+    // One tile each being decoded, plus this thread
+    assert(workers < m_decoding.capacity());
+    for (auto i = 0u; i < workers; i++)
+    {
+        m_workers.push_back(std::make_unique<Worker>(*this));
+    }
 }
 
+TileProducer::~TileProducer() = default;
+
+void
+TileProducer::OnStartup()
+{
+    // The other core, which mostly waits for the GPS and the routes
+    for (auto& worker : m_workers)
+    {
+        worker->Start(0, os::ThreadPriority::kNormal);
+    }
+}
+
+
+void
+TileProducer::AttachGpsPort(std::unique_ptr<IGpsPort> gps_port)
+{
+    m_gps_port = std::move(gps_port);
+    m_gps_port->AwakeOn(GetSemaphore());
+}
+
+void
+TileProducer::AwakeOnTiles(os::binary_semaphore& semaphore)
+{
+    m_pending_tile_semaphore = &semaphore;
+}
 
 // Context: Another thread
 std::unique_ptr<ITileHandle>
@@ -220,10 +482,17 @@ TileProducer::LockTile(const Point& point)
     if (index)
     {
         m_mutex.lock();
+        NoteVisibleTile(*index);
+
+        if (m_failed_tiles[*index])
+        {
+            m_mutex.unlock();
+            return nullptr;
+        }
 
         while (m_tile_index_to_cache[*index] == kInvalidTileIndex)
         {
-            m_tile_requests.push(*index);
+            m_tile_requests.push_back(*index);
 
             // Release the lock while waiting for the producer thread
             m_mutex.unlock();
@@ -240,7 +509,7 @@ TileProducer::LockTile(const Point& point)
 
         auto cache_index = m_tile_index_to_cache[*index];
         auto out = std::make_unique<TileHandle>(
-            *m_tiles[cache_index], cache_index, m_locked_cache_entries);
+            *m_tiles[cache_index], m_color_mode, cache_index, m_locked_cache_entries);
         m_mutex.unlock();
 
         return std::move(out);
@@ -249,6 +518,43 @@ TileProducer::LockTile(const Point& point)
     return nullptr;
 }
 
+// Context: Another thread
+TileLookup
+TileProducer::TryLockTile(const Point& point)
+{
+    auto index = PointToTileIndex(point);
+    if (!index)
+    {
+        return {TileState::kMissing, nullptr};
+    }
+
+    std::scoped_lock lock(m_mutex);
+    NoteVisibleTile(*index);
+
+    // Drawn as without a tile, as LockTile does it
+    if (m_failed_tiles[*index])
+    {
+        return {TileState::kMissing, nullptr};
+    }
+
+    if (auto cache_index = m_tile_index_to_cache[*index]; cache_index != kInvalidTileIndex)
+    {
+        return {TileState::kReady,
+                std::make_unique<TileHandle>(
+                    *m_tiles[cache_index], m_color_mode, cache_index, m_locked_cache_entries)};
+    }
+
+    // When full, it's asked for again with the next frame
+    if (!m_pending_tiles.full() &&
+        std::ranges::find(m_pending_tiles, *index) == m_pending_tiles.end())
+    {
+        m_pending_tiles.push_back(*index);
+        Awake();
+    }
+
+    return {TileState::kPending, nullptr};
+}
+
 bool
 TileProducer::IsCached(const Point& point) const
 {
@@ -266,46 +572,174 @@ TileProducer::IsCached(const Point& point) const
 std::optional<milliseconds>
 TileProducer::OnActivation()
 {
-    uint32_t requested_index = 0;
-
     auto color_mode = m_application_state.CheckoutReadonly()->color_mode;
     if (color_mode != m_color_mode)
     {
+        std::scoped_lock lock(m_mutex);
         m_color_mode = color_mode;
 
-        // Drop all cached data
-        std::scoped_lock lock(m_mutex);
-        m_tiles.clear();
-        m_tile_request_order.clear();
-        m_tile_index_to_cache.clear();
-        m_tile_index_to_cache.resize(m_tile_count);
-        std::ranges::fill(m_tile_index_to_cache, kInvalidTileIndex);
+        // Palette tiles take the color mode when drawn
+        if constexpr (!kPaletteTiles)
+        {
+            // Drop all cached data, and the tiles being decoded in the old mode
+            m_cache_generation++;
+            m_tiles.clear();
+            m_tile_request_order.clear();
+            m_tile_index_to_cache.clear();
+            m_tile_index_to_cache.resize(m_tile_count);
+            std::ranges::fill(m_tile_index_to_cache, kInvalidTileIndex);
+        }
+    }
+
+    if (m_gps_port)
+    {
+        if (auto position = m_gps_port->Poll(); position)
+        {
+            PredictTiles(*position);
+        }
+    }
+
+    for (auto& worker : m_workers)
+    {
+        worker->Awake();
+    }
+
+    // One at a time, to check the color mode and the position in between
+    if (RunJob())
+    {
+        return 0ms;
     }
 
-    while (m_tile_requests.pop(requested_index))
+    return std::nullopt;
+}
+
+std::optional<TileProducer::DecodeJob>
+TileProducer::ClaimJob()
+{
+    auto is_decoding = [this](auto index) {
+        return std::ranges::find(m_decoding, index) != m_decoding.end();
+    };
+    auto claim = [this](auto index, auto kind) {
+        m_decoding.push_back(index);
+        return DecodeJob {index, kind, m_color_mode, m_cache_generation};
+    };
+
+    // Waited for by LockTile first. If being decoded, it's taken when that is done
+    while (!m_tile_requests.empty() && !is_decoding(m_tile_requests.front()))
     {
-        CacheTile(requested_index);
+        auto index = m_tile_requests.front();
+        m_tile_requests.pop_front();
+
+        if (m_tile_index_to_cache[index] == kInvalidTileIndex && !m_failed_tiles[index])
+        {
+            return claim(index, DecodeKind::kRequested);
+        }
+
+        // Decoded (or failed) meanwhile
         m_tile_request_semaphore.release();
     }
 
+    // Then those drawn as placeholders, which are kept until decoded to not be asked for twice
+    for (auto it = m_pending_tiles.begin(); it != m_pending_tiles.end();)
+    {
+        if (is_decoding(*it))
+        {
+            ++it;
+            continue;
+        }
+        if (m_tile_index_to_cache[*it] == kInvalidTileIndex && !m_failed_tiles[*it])
+        {
+            return claim(*it, DecodeKind::kPending);
+        }
+
+        it = m_pending_tiles.erase(it);
+        if (m_pending_tile_semaphore)
+        {
+            m_pending_tile_semaphore->release();
+        }
+    }
+
+    // And last the speculative ones
+    while (!m_prefetch_tiles.empty())
+    {
+        auto index = m_prefetch_tiles.front();
+        m_prefetch_tiles.erase(m_prefetch_tiles.begin());
+
+        if (!is_decoding(index) && !m_failed_tiles[index] &&
+            m_tile_index_to_cache[index] == kInvalidTileIndex)
+        {
+            return claim(index, DecodeKind::kPrefetch);
+        }
+    }
+
     return std::nullopt;
 }
 
 bool
-TileProducer::CacheTile(unsigned requested_index)
+TileProducer::RunJob()
 {
-    auto tile = DecodeTile(requested_index);
-    if (!tile)
+    std::optional<DecodeJob> job;
+
+    {
+        std::scoped_lock lock(m_mutex);
+        job = ClaimJob();
+    }
+    if (!job)
     {
         return false;
     }
 
+    // Without the lock, so that the other threads decode meanwhile
+    auto tile = DecodeTile(job->index, job->color_mode);
+
     std::scoped_lock lock(m_mutex);
+    m_decoding.erase(std::ranges::find(m_decoding, job->index));
+
+    // The tile data doesn't change, so it would fail again
+    const auto failed = tile == nullptr;
+    if (failed)
+    {
+        m_failed_tiles[job->index] = true;
+    }
+
+    auto inserted =
+        tile && job->generation == m_cache_generation && InsertTile(*job, std::move(tile));
+
+    if (job->kind == DecodeKind::kRequested)
+    {
+        m_tile_request_semaphore.release();
+    }
+    else if (job->kind == DecodeKind::kPending)
+    {
+        m_pending_tiles.erase(std::ranges::find(m_pending_tiles, job->index));
+
+        // A failed tile is reported as missing from now on, so the UI can move on. Not when
+        // dropped for another reason, to not spin on asking for it again
+        if ((inserted || failed) && m_pending_tile_semaphore)
+        {
+            m_pending_tile_semaphore->release();
+        }
+    }
+
+    return true;
+}
+
+bool
+TileProducer::InsertTile(const DecodeJob& job, std::unique_ptr<TileImpl> tile)
+{
     auto cache_index = m_tiles.size();
 
     if (m_tiles.full())
     {
-        cache_index = EvictTile();
+        // Speculative tiles never replace the ones in view
+        auto evicted = job.kind == DecodeKind::kPrefetch ? EvictTileOutside(m_visible_tiles)
+                                                         : std::optional<uint8_t>(EvictTile());
+        if (!evicted)
+        {
+            return false;
+        }
+
+        cache_index = *evicted;
         assert(m_tiles[cache_index] == nullptr);
         m_tiles[cache_index] = std::move(tile);
     }
@@ -313,13 +747,103 @@ TileProducer::CacheTile(unsigned requested_index)
     {
         m_tiles.push_back(std::move(tile));
     }
-    m_tile_request_order.push_back(requested_index);
+    m_tile_request_order.push_back(job.index);
 
-    m_tile_index_to_cache[requested_index] = cache_index;
+    m_tile_index_to_cache[job.index] = cache_index;
 
     return true;
 }
 
+void
+TileProducer::PredictTiles(const GpsData& position)
+{
+    std::scoped_lock lock(m_mutex);
+
+    m_prefetch_tiles.clear();
+
+    if (kPrefetchTiles == 0 || position.speed < kMinPrefetchSpeed)
+    {
+        return;
+    }
+
+    // Heading 0 is north, i.e., up on the map
+    const auto heading = position.heading * std::numbers::pi_v<float> / 180;
+    const auto distance = position.speed >= kFastSpeed ? 2 * kTileSize : kTileSize;
+    const auto ahead =
+        Point {position.pixel_position.x + static_cast<int32_t>(std::sin(heading) * distance),
+               position.pixel_position.y - static_cast<int32_t>(std::cos(heading) * distance)};
+
+    auto upcoming = TilesAround(ahead);
+    std::erase_if(upcoming, [this](auto index) {
+        return m_tile_index_to_cache[index] != kInvalidTileIndex ||
+               std::ranges::find(m_visible_tiles, index) != m_visible_tiles.end();
+    });
+
+    // The closest come into view first
+    auto distance_to = [this, &position](auto index) {
+        const auto dx = static_cast<int>(index % m_tile_row_size) * kTileSize + kTileSize / 2 -
+                        position.pixel_position.x;
+        const auto dy = static_cast<int>(index / m_tile_row_size) * kTileSize + kTileSize / 2 -
+                        position.pixel_position.y;
+
+        return dx * dx + dy * dy;
+    };
+    std::ranges::sort(upcoming, {}, distance_to);
+
+    for (auto index : upcoming)
+    {
+        if (m_prefetch_tiles.size() == kPrefetchTiles)
+        {
+            break;
+        }
+        m_prefetch_tiles.push_back(index);
+    }
+}
+
+TileProducer::TileIndices
+TileProducer::TilesAround(const Point& center) const
+{
+    TileIndices out;
+
+    // As the map screen places the view. A map smaller than the display starts at the corner
+    const auto left =
+        std::clamp(static_cast<int>(center.x - hal::kDisplayWidth / 2),
+                   0,
+                   std::max(0, static_cast<int>(m_tile_row_size) * kTileSize - hal::kDisplayWidth));
+    const auto top = std::clamp(
+        static_cast<int>(center.y - hal::kDisplayHeight / 2),
+        0,
+        std::max(0, static_cast<int>(m_tile_rows) * kTileSize - hal::kDisplayHeight));
+
+    for (auto y = top - top % kTileSize; y < top + hal::kDisplayHeight; y += kTileSize)
+    {
+        for (auto x = left - left % kTileSize; x < left + hal::kDisplayWidth; x += kTileSize)
+        {
+            if (auto index = PointToTileIndex({x, y}); index)
+            {
+                out.push_back(*index);
+            }
+        }
+    }
+
+    return out;
+}
+
+void
+TileProducer::NoteVisibleTile(uint32_t index)
+{
+    if (auto it = std::ranges::find(m_visible_tiles, index); it != m_visible_tiles.end())
+    {
+        m_visible_tiles.erase(it);
+    }
+    else if (m_visible_tiles.full())
+    {
+        m_visible_tiles.erase(m_visible_tiles.begin());
+    }
+
+    m_visible_tiles.push_back(index);
+}
+
 uint8_t
 TileProducer::EvictTile()
 {
@@ -363,56 +887,68 @@ TileProducer::EvictTile()
     return 0;
 }
 
-std::unique_ptr<ImageImpl>
-TileProducer::DecodeTile(unsigned index)
+std::optional<uint8_t>
+TileProducer::EvictTileOutside(const TileIndices& visible)
+{
+    // The least recently requested first
+    for (auto it = m_tile_request_order.begin(); it != m_tile_request_order.end(); ++it)
+    {
+        const auto index = *it;
+
+        if (std::ranges::find(visible, index) != visible.end())
+        {
+            continue;
+        }
+
+        for (auto i = 0u; i < m_tiles.size(); i++)
+        {
+            auto& tile = m_tiles[i];
+
+            if (tile && tile->index == index && !(m_locked_cache_entries & (1 << i)))
+            {
+                m_tile_request_order.erase(it);
+                m_tile_index_to_cache[index] = kInvalidTileIndex;
+                m_tiles[i] = nullptr;
+
+                return i;
+            }
+        }
+    }
+
+    return std::nullopt;
+}
+
+std::unique_ptr<TileImpl>
+TileProducer::DecodeTile(unsigned index, ApplicationState::ColorMode color_mode)
 {
     if (index >= m_tile_count)
     {
         return nullptr;
     }
 
-    auto png = std::make_unique<PNG>();
-
     const auto& tile = m_flash_tile_data[index];
     const auto flash_data = m_flash_start + tile.flash_offset;
     const auto tile_size = tile.size;
 
-    auto in_psram = std::make_unique<uint8_t[]>(tile_size);
-    memcpy(in_psram.get(), flash_data, tile_size);
+    auto img = std::make_unique<TileImpl>(index);
 
-    int rc;
-
-    if (m_color_mode == ApplicationState::ColorMode::kColor)
-    {
-        rc = png->openFLASH(in_psram.get(), tile_size, PngDraw);
-    }
-    else
+    if (m_tile_codec == TileCodec::kRle && IsRleTile({flash_data, tile_size}))
     {
-        rc = png->openFLASH(in_psram.get(), tile_size, PngDrawGrayscale);
-    }
+        if (!DecodeRleInto({flash_data, tile_size}, *img, color_mode))
+        {
+            return nullptr;
+        }
 
-    if (rc != PNG_SUCCESS)
-    {
-        return nullptr;
+        return img;
     }
-    auto img = std::make_unique<ImageImpl>(index);
 
-    if (m_color_mode == ApplicationState::ColorMode::kColor)
-    {
-        DecodeHelper priv(*png, reinterpret_cast<uint16_t*>(img->rgb565_data.data()));
-        rc = png->decode((void*)&priv, 0);
-    }
-    else
-    {
-        DecodeHelperGrayscale priv(*png,
-                                   reinterpret_cast<uint16_t*>(img->rgb565_data.data()),
-                                   m_color_mode == ApplicationState::ColorMode::kBlackRed ? 0xf800
-                                                                                          : 0x0000);
+    auto png = std::make_unique<PNG>();
 
-        rc = png->decode((void*)&priv, 0);
-    }
+    auto in_psram = std::make_unique<uint8_t[]>(tile_size);
+    memcpy(in_psram.get(), flash_data, tile_size);
+
+    auto rc = DecodeInto(*png, in_psram.get(), tile_size, *img, color_mode);
 
-    png->close();
     if (rc != PNG_SUCCESS)
     {
         //printf("Argh tile %d @%p\n", index, flash_data);
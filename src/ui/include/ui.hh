@@ -115,7 +115,7 @@ private:
     std::unique_ptr<os::ITimer> m_gps_position_timer;
 
 
-    std::vector<IndexType> m_route;
+    RouteBuffer m_route;
     std::optional<unsigned> m_passed_route_index;
 
     etl::queue_spsc_atomic<hal::IInput::Event, 4> m_input_queue;
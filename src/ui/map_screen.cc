@@ -8,6 +8,8 @@
 
 constexpr auto kMaxKnots = 30;
 constexpr auto kSpeedometerMaxAngle = 202;
+// Gray, shown until the tile has been decoded
+constexpr uint16_t kPendingTileColor = 0x8410;
 
 UserInterface::MapScreen::MapScreen(UserInterface& parent)
     : m_parent(parent)
@@ -421,13 +423,13 @@ UserInterface::MapScreen::DrawRoute()
     m_route_line->remaining_points.clear();
     lv_line_set_points(m_route_line->lv_passed_line, {}, 0);
     lv_line_set_points(m_route_line->lv_remaining_line, {}, 0);
-    if (m_parent.m_route.empty())
+    if (m_parent.m_route.Span().empty())
     {
         return;
     }
 
     auto index = 0;
-    auto route_iterator = RouteIterator(m_parent.m_route, m_parent.m_land_mask_row_size);
+    auto route_iterator = RouteIterator(m_parent.m_route.Span(), m_parent.m_land_mask_row_size);
     auto last_point = route_iterator.Next();
 
     if (!last_point)
@@ -481,18 +483,26 @@ UserInterface::MapScreen::DrawMapTiles(const Point& position)
     auto start_x = position.x - x_remainder;
     auto start_y = position.y - y_remainder;
 
-    // Blit all needed tiles
+    // Blit all needed tiles. The producer wakes the UI up to redraw when pending ones are ready
     for (auto y = 0; y < num_tiles_y; y++)
     {
         for (auto x = 0; x < num_tiles_x; x++)
         {
-            auto tile = m_parent.m_tile_producer.LockTile(
+            auto lookup = m_parent.m_tile_producer.TryLockTile(
                 {start_x + x * kTileSize, start_y + y * kTileSize});
-            if (tile)
+            auto to = painter::Rect {
+                x * kTileSize - x_remainder, y * kTileSize - y_remainder, kTileSize, kTileSize};
+
+            if (lookup.state == TileState::kReady)
             {
                 painter::Blit(reinterpret_cast<uint16_t*>(m_static_map_buffer.get()),
-                              tile->GetImage(),
-                              {x * kTileSize - x_remainder, y * kTileSize - y_remainder});
+                              lookup.tile->GetImage(),
+                              to);
+            }
+            else if (lookup.state == TileState::kPending)
+            {
+                painter::Fill(
+                    reinterpret_cast<uint16_t*>(m_static_map_buffer.get()), kPendingTileColor, to);
             }
         }
     }
@@ -563,7 +573,11 @@ UserInterface::MapScreen::PrepareInitialZoomedOutMap()
 
     for (const auto& position : cached_tiles)
     {
-        DrawZoomedTile(position);
+        if (!DrawZoomedTile(position))
+        {
+            // Evicted meanwhile
+            m_zoomed_out_map_tiles.push_back(position);
+        }
     }
 
     m_parent.Awake();
@@ -572,36 +586,51 @@ UserInterface::MapScreen::PrepareInitialZoomedOutMap()
 void
 UserInterface::MapScreen::FillZoomedOutMap()
 {
+    // A row at a time, all asked for at once to be decoded in parallel
     const auto num_tiles_x = hal::kDisplayWidth / (kTileSize / m_zoom_level);
-    for (auto i = 0; i < num_tiles_x; i++)
+    const auto last = m_zoomed_out_map_tiles.size();
+    const auto first = last - std::min(last, static_cast<size_t>(num_tiles_x));
+    auto drawn = false;
+
+    for (auto i = last; i > first; i--)
     {
-        if (m_zoomed_out_map_tiles.empty())
+        auto it = m_zoomed_out_map_tiles.begin() + i - 1;
+
+        if (DrawZoomedTile(*it))
         {
-            break;
+            m_zoomed_out_map_tiles.erase(it);
+            drawn = true;
         }
-
-        auto position = m_zoomed_out_map_tiles.back();
-        DrawZoomedTile(position);
-        m_zoomed_out_map_tiles.pop_back();
     }
 
-    m_parent.Awake();
+    // Otherwise the tile producer wakes the UI up when the tiles are decoded
+    if (drawn)
+    {
+        m_parent.Awake();
+    }
 }
 
-void
+bool
 UserInterface::MapScreen::DrawZoomedTile(const Point& position)
 {
-    auto tile = m_parent.m_tile_producer.LockTile(position);
-    if (tile)
+    auto lookup = m_parent.m_tile_producer.TryLockTile(position);
+    if (lookup.state == TileState::kPending)
+    {
+        return false;
+    }
+
+    if (lookup.state == TileState::kReady)
     {
         auto dst = Point {position.x - m_map_position_zoomed_out.x,
                           position.y - m_map_position_zoomed_out.y};
         painter::ZoomedBlit(reinterpret_cast<uint16_t*>(m_static_map_buffer.get()),
                             hal::kDisplayWidth,
-                            tile->GetImage(),
+                            lookup.tile->GetImage(),
                             m_zoom_level,
                             {dst.x / m_zoom_level, dst.y / m_zoom_level});
     }
+
+    return true;
 }
 
 void
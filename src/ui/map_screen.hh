@@ -64,7 +64,8 @@ private:
 
     void PrepareInitialZoomedOutMap();
     void FillZoomedOutMap();
-    void DrawZoomedTile(const Point& position);
+    // False while the tile is being decoded
+    bool DrawZoomedTile(const Point& position);
 
     void RunStateMachine();
 
@@ -34,6 +34,7 @@ UserInterface::UserInterface(ApplicationState& application_state,
     input.AttachListener(this);
     m_gps_port->AwakeOn(GetSemaphore());
     m_route_listener->AwakeOn(GetSemaphore());
+    m_tile_producer.AwakeOnTiles(GetSemaphore());
 }
 
 void
@@ -139,16 +140,24 @@ UserInterface::OnActivation()
     {
         if (route->type == IRouteListener::EventType::kReady)
         {
-            m_route.clear();
-            std::ranges::copy(route->route, std::back_inserter(m_route));
+            m_route = route->route;
             m_calculating_route = false;
+
+            // Also when repaired, and then starting from the boat
+            m_passed_route_index = std::nullopt;
+        }
+        else if (route->type == IRouteListener::EventType::kIntermediate)
+        {
+            // Shown while a better one is calculated
+            m_route = route->route;
+            m_passed_route_index = std::nullopt;
         }
         else
         {
             // For now always
             m_calculating_route = route->type == IRouteListener::EventType::kCalculating;
 
-            m_route.clear();
+            m_route = {};
             m_passed_route_index = std::nullopt;
         }
     }
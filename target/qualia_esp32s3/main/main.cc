@@ -24,6 +24,8 @@
 namespace
 {
 
+// Print the metrics of each route search on the serial console, to see how they do on the device
+constexpr auto kPrintRouteMetrics = false;
 
 constexpr auto kTftDEPin = 2;
 constexpr auto kTftVSYNCPin = 42;
@@ -210,6 +212,12 @@ app_main(void)
     srand(esp_random());
 
     auto map_metadata = reinterpret_cast<const MapMetadata*>(p);
+    if (map_metadata->magic != kMetadataMagic)
+    {
+        // Not a map, or one from an older tiler.py with another layout
+        printf("map_data doesn't hold a map of this version, flash a new map.bin\n");
+        assert(false);
+    }
 
     auto target_nvm = std::make_unique<NvmTarget>();
 
@@ -232,15 +240,19 @@ app_main(void)
 
 
     // Threads
-    auto route_service = std::make_unique<RouteService>(*map_metadata);
+    auto route_service = std::make_unique<RouteService>(*map_metadata, state);
+    route_service->SetMetricsPrinting(kPrintRouteMetrics);
     auto storage = std::make_unique<Storage>(*target_nvm, state, route_service->AttachListener());
-    auto producer = std::make_unique<TileProducer>(state, *map_metadata);
+    // A worker on the other core
+    auto producer = std::make_unique<TileProducer>(state, *map_metadata, 1);
     auto gps_simulator = std::make_unique<GpsSimulator>(*map_metadata, state, *route_service);
 
     // Selects between the real and demo GPS
     auto gps_mux = std::make_unique<GpsMux>(state, *gps_device, *gps_simulator);
 
     auto gps_reader = std::make_unique<GpsReader>(*map_metadata, *gps_mux);
+    route_service->AttachGpsPort(gps_reader->AttachListener());
+    producer->AttachGpsPort(gps_reader->AttachListener());
     auto ui = std::make_unique<UserInterface>(state,
                                               *map_metadata,
                                               *producer,
@@ -0,0 +1,389 @@
+// Replays route queries on a map.bin, and reports the latency, search effort and route cost of
+// each, to compare router changes between commits.
+//
+//   router_benchmark [-m map.bin] [-q queries.txt] [-n count] [-s seed] [-e engine]
+//                    [-w weight] [-p] [-o results.json]
+//
+// The queries file has one route per line, "from_x from_y to_x to_y" in map pixels (as for
+// RouteService::RequestRoute). Without it, count random water points are used. -p turns off the
+// block-sparse land mask, the abstract graph and the landmarks from map.bin, and -o writes the
+// results as JSON.
+//
+// The memory of each query is that of its search (node cache and open set entries), and the peak
+// RSS of the whole run is reported once.
+
+#include "route_utils.hh"
+#include "router.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <fmt/format.h>
+#include <fstream>
+#include <random>
+#include <string>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using BenchmarkRouter = Router<kTargetCacheSize>;
+
+namespace
+{
+
+struct Query
+{
+    Point from;
+    Point to;
+};
+
+struct Result
+{
+    Query query;
+    double latency_ms;
+    unsigned nodes_expanded;
+    unsigned partial_paths;
+    // The bidirectional search ran out of nodes after the frontiers met
+    bool meeting_unproven;
+    unsigned nodes_used;
+    size_t points;
+    CostType cost;
+    size_t search_memory_kib;
+};
+
+// Of the process, over the whole run
+long
+PeakRssKiB()
+{
+    rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    // In bytes
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+// As RouteService::RandomWaterPoint, but repeatable with a seed
+Point
+RandomWaterPoint(std::mt19937& rng, const LandMask& land_mask)
+{
+    Point p;
+
+    do
+    {
+        p = {static_cast<int32_t>((rng() % land_mask.Width()) * kPathFinderTileSize),
+             static_cast<int32_t>((rng() % land_mask.Height()) * kPathFinderTileSize)};
+    } while (IsWater(land_mask, PointToLandIndex(p, land_mask.Width())) == false);
+
+    return p;
+}
+
+std::vector<Query>
+ReadQueries(const char* path)
+{
+    std::vector<Query> out;
+    std::ifstream f(path);
+    Query query;
+
+    while (f >> query.from.x >> query.from.y >> query.to.x >> query.to.y)
+    {
+        out.push_back(query);
+    }
+
+    return out;
+}
+
+double
+Percentile(std::vector<double> values, unsigned percent)
+{
+    if (values.empty())
+    {
+        return 0;
+    }
+
+    std::ranges::sort(values);
+
+    return values[std::min(values.size() - 1, values.size() * percent / 100)];
+}
+
+std::optional<BenchmarkRouter::Engine>
+ParseEngine(std::string_view name)
+{
+    if (name == "astar")
+    {
+        return BenchmarkRouter::Engine::kAstar;
+    }
+    else if (name == "jps")
+    {
+        return BenchmarkRouter::Engine::kJumpPointSearch;
+    }
+    else if (name == "bidirectional")
+    {
+        return BenchmarkRouter::Engine::kBidirectional;
+    }
+
+    return std::nullopt;
+}
+
+void
+WriteJson(FILE* f,
+          const char* map_file,
+          std::string_view engine,
+          std::string_view heuristic,
+          unsigned weight,
+          std::span<const Result> results,
+          std::span<const double> latencies)
+{
+    fmt::print(f,
+               "{{\n  \"map\": \"{}\",\n  \"engine\": \"{}\",\n  \"heuristic\": \"{}\",\n  "
+               "\"weight\": {},\n  \"queries\": [\n",
+               map_file,
+               engine,
+               heuristic,
+               weight);
+    for (auto i = 0u; i < results.size(); i++)
+    {
+        const auto& r = results[i];
+
+        fmt::print(f,
+                   "    {{\"from\": [{}, {}], \"to\": [{}, {}], \"latency_ms\": {:.3f}, "
+                   "\"nodes_expanded\": {}, \"partial_paths\": {}, \"meeting_unproven\": {}, "
+                   "\"nodes_used\": {}, "
+                   "\"points\": {}, \"cost\": {}, \"search_memory_kib\": {}}}{}\n",
+                   r.query.from.x,
+                   r.query.from.y,
+                   r.query.to.x,
+                   r.query.to.y,
+                   r.latency_ms,
+                   r.nodes_expanded,
+                   r.partial_paths,
+                   r.meeting_unproven,
+                   r.nodes_used,
+                   r.points,
+                   r.cost,
+                   r.search_memory_kib,
+                   i + 1 < results.size() ? "," : "");
+    }
+
+    std::vector<double> values(latencies.begin(), latencies.end());
+    fmt::print(f,
+               "  ],\n  \"latency_ms\": {{\"p50\": {:.3f}, \"p90\": {:.3f}, \"p99\": {:.3f}, "
+               "\"max\": {:.3f}}},\n  \"peak_rss_kib\": {}\n}}\n",
+               Percentile(values, 50),
+               Percentile(values, 90),
+               Percentile(values, 99),
+               Percentile(values, 100),
+               PeakRssKiB());
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    const char* map_file = "map.bin";
+    const char* queries_file = nullptr;
+    const char* json_file = nullptr;
+    std::string engine_name = "astar";
+    unsigned count = 100;
+    unsigned seed = 0;
+    unsigned weight = 100;
+    auto plain = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:q:n:s:e:w:po:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+            map_file = optarg;
+            break;
+        case 'q':
+            queries_file = optarg;
+            break;
+        case 'n':
+            count = std::stoul(optarg);
+            break;
+        case 's':
+            seed = std::stoul(optarg);
+            break;
+        case 'e':
+            engine_name = optarg;
+            break;
+        case 'w':
+            weight = std::stoul(optarg);
+            break;
+        case 'p':
+            plain = true;
+            break;
+        case 'o':
+            json_file = optarg;
+            break;
+        default:
+            fmt::print("Usage: {} [-m map.bin] [-q queries.txt] [-n count] [-s seed] "
+                       "[-e astar|jps|bidirectional] [-w weight] [-p] [-o results.json]\n",
+                       argv[0]);
+            return 1;
+        }
+    }
+
+    auto engine = ParseEngine(engine_name);
+    if (!engine || weight < 100)
+    {
+        fmt::print("Invalid engine {} or weight {}\n", engine_name, weight);
+        return 1;
+    }
+
+    auto fd = open(map_file, O_RDONLY);
+    if (fd < 0)
+    {
+        fmt::print("Failed to open {}\n", map_file);
+        return 1;
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+    auto mmap_bin = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mmap_bin == MAP_FAILED)
+    {
+        fmt::print("Failed to map {}\n", map_file);
+        return 1;
+    }
+
+    auto map_metadata = reinterpret_cast<const MapMetadata*>(mmap_bin);
+    if (static_cast<size_t>(st.st_size) < sizeof(MapMetadata) ||
+        map_metadata->magic != kMetadataMagic)
+    {
+        fmt::print("{} is not a map of this version, rebuild it with tiler.py\n", map_file);
+        return 1;
+    }
+    auto map_data = reinterpret_cast<const uint8_t*>(mmap_bin);
+
+    const auto row_size = map_metadata->land_mask_row_size;
+    const auto rows = map_metadata->land_mask_rows;
+    auto land_mask = LandMask(
+        std::span<const uint32_t>(
+            reinterpret_cast<const uint32_t*>(map_data + map_metadata->land_mask_data_offset),
+            (rows * row_size) / 32),
+        row_size,
+        rows);
+
+    // Set up as in RouteService
+    if (!plain && map_metadata->block_land_mask_offset != 0)
+    {
+        auto blocks = LandMask(std::span<const uint32_t>(
+            reinterpret_cast<const uint32_t*>(map_data + map_metadata->block_land_mask_offset),
+            map_metadata->block_land_mask_size / sizeof(uint32_t)));
+        if (blocks.IsValid())
+        {
+            land_mask = blocks;
+        }
+    }
+    fmt::print("{}x{} land mask, {} bytes\n", row_size, rows, land_mask.DataSize());
+
+    auto router = std::make_unique<BenchmarkRouter>(land_mask, *engine);
+    router->SetSmoothing(true);
+    router->SetHeuristicWeight(weight);
+
+    std::unique_ptr<AbstractGraph> abstract_graph;
+    std::unique_ptr<Landmarks> landmarks;
+    if (!plain && map_metadata->abstract_graph_offset != 0)
+    {
+        abstract_graph = std::make_unique<AbstractGraph>(std::span<const uint32_t>(
+            reinterpret_cast<const uint32_t*>(map_data + map_metadata->abstract_graph_offset),
+            map_metadata->abstract_graph_size / sizeof(uint32_t)));
+        router->SetAbstractGraph(abstract_graph.get());
+    }
+    if (!plain && map_metadata->landmarks_offset != 0)
+    {
+        landmarks = std::make_unique<Landmarks>(std::span<const uint32_t>(
+            reinterpret_cast<const uint32_t*>(map_data + map_metadata->landmarks_offset),
+            map_metadata->landmarks_size / sizeof(uint32_t)));
+        router->SetLandmarks(landmarks.get());
+    }
+    // The engines don't all search with the same heuristic, which matters when comparing them
+    fmt::print(
+        "{} engine, {} heuristic, weight {}\n", engine_name, router->HeuristicName(), weight);
+
+    std::vector<Query> queries;
+    if (queries_file)
+    {
+        queries = ReadQueries(queries_file);
+    }
+    else
+    {
+        std::mt19937 rng(seed);
+
+        for (auto i = 0u; i < count; i++)
+        {
+            auto from = RandomWaterPoint(rng, land_mask);
+            queries.push_back({from, RandomWaterPoint(rng, land_mask)});
+        }
+    }
+
+    std::vector<Result> results;
+    std::vector<double> latencies;
+    for (const auto& query : queries)
+    {
+        const auto before = std::chrono::steady_clock::now();
+        auto route = router->CalculateRoute(query.from, query.to);
+        const auto latency =
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - before);
+        const auto stats = router->GetStats();
+
+        results.push_back({query,
+                           latency.count(),
+                           stats.nodes_expanded,
+                           stats.partial_paths,
+                           stats.meeting_unproven,
+                           stats.nodes_used,
+                           route.size(),
+                           router->RouteCost(route),
+                           (router->SearchMemory() + 1023) / 1024});
+        latencies.push_back(latency.count());
+
+        fmt::print("{},{} -> {},{}: {:.3f}ms, {} expanded nodes, {} partial paths{}, {} points, "
+                   "cost {}, {} KiB searched\n",
+                   query.from.x,
+                   query.from.y,
+                   query.to.x,
+                   query.to.y,
+                   latency.count(),
+                   stats.nodes_expanded,
+                   stats.partial_paths,
+                   stats.meeting_unproven ? " (out of nodes after meeting)" : "",
+                   route.size(),
+                   router->RouteCost(route),
+                   results.back().search_memory_kib);
+    }
+
+    fmt::print("{} queries, latency p50 {:.3f}ms, p90 {:.3f}ms, p99 {:.3f}ms, max {:.3f}ms, peak "
+               "RSS {} KiB\n",
+               results.size(),
+               Percentile(latencies, 50),
+               Percentile(latencies, 90),
+               Percentile(latencies, 99),
+               Percentile(latencies, 100),
+               PeakRssKiB());
+
+    if (json_file)
+    {
+        auto f = fopen(json_file, "w");
+        if (!f)
+        {
+            fmt::print("Failed to open {}\n", json_file);
+            return 1;
+        }
+        WriteJson(f, map_file, engine_name, router->HeuristicName(), weight, results, latencies);
+        fclose(f);
+    }
+
+    munmap(mmap_bin, st.st_size);
+
+    return 0;
+}
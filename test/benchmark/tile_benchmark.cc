@@ -0,0 +1,263 @@
+// Decodes the tiles of a map.bin with each tile codec, and reports the decode time per tile and the
+// size, to compare the codecs on the same chart.
+//
+//   tile_benchmark [-m map.bin] [-n count]
+//
+// PNG tiles are also encoded as RLE tiles (as tiler.py --rle does), so a PNG map compares both.
+// Tiles are decoded to palette indices, as TileProducer does it. The times are for the host, but
+// the ratio between the codecs is what to look at.
+
+#include "tile.hh"
+#include "tile_codec.hh"
+
+#include <PNGdec.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <fmt/format.h>
+#include <limits>
+#include <memory>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+
+struct DecodedTile
+{
+    std::array<uint16_t, 256> palette;
+    std::vector<uint8_t> indices;
+};
+
+struct CodecResult
+{
+    std::vector<double> latencies;
+    size_t bytes {0};
+};
+
+double
+Percentile(std::vector<double> values, unsigned percent)
+{
+    if (values.empty())
+    {
+        return 0;
+    }
+
+    std::ranges::sort(values);
+
+    return values[std::min(values.size() - 1, values.size() * percent / 100)];
+}
+
+// As PngDrawIndexed in TileProducer
+void
+PngDraw(PNGDRAW* pDraw)
+{
+    auto tile = static_cast<DecodedTile*>(pDraw->pUser);
+
+    if (pDraw->y == 0)
+    {
+        for (auto i = 0u; i < tile->palette.size(); i++)
+        {
+            const auto rgb = &pDraw->pPalette[i * 3];
+
+            tile->palette[i] = ((rgb[0] & 0xf8) << 8) | ((rgb[1] & 0xfc) << 3) | (rgb[2] >> 3);
+        }
+    }
+
+    const auto bpp = pDraw->iBpp;
+    const auto mask = (1 << bpp) - 1;
+    const auto dst = &tile->indices[pDraw->y * pDraw->iWidth];
+
+    for (auto x = 0; x < pDraw->iWidth; x++)
+    {
+        const auto bit = x * bpp;
+
+        dst[x] = (pDraw->pPixels[bit / 8] >> (8 - bpp - bit % 8)) & mask;
+    }
+}
+
+// With the copy to RAM, as TileProducer does it
+bool
+DecodePng(std::span<const uint8_t> data, DecodedTile& tile)
+{
+    auto png = std::make_unique<PNG>();
+    auto in_ram = std::make_unique<uint8_t[]>(data.size());
+
+    memcpy(in_ram.get(), data.data(), data.size());
+    if (png->openFLASH(in_ram.get(), data.size(), PngDraw) != PNG_SUCCESS)
+    {
+        return false;
+    }
+
+    int rc = PNG_UNSUPPORTED_FEATURE;
+    if (png->getPixelType() == PNG_PIXEL_INDEXED && png->getWidth() == kTileSize &&
+        png->getHeight() == kTileSize)
+    {
+        rc = png->decode(&tile, 0);
+    }
+    png->close();
+
+    return rc == PNG_SUCCESS;
+}
+
+template <typename Decoder>
+bool
+Measure(CodecResult& result, std::span<const uint8_t> data, Decoder decoder)
+{
+    const auto before = std::chrono::steady_clock::now();
+    auto ok = decoder(data);
+    const auto latency =
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - before);
+
+    if (ok)
+    {
+        result.latencies.push_back(latency.count());
+        result.bytes += data.size();
+    }
+
+    return ok;
+}
+
+void
+Report(std::string_view name, const CodecResult& result)
+{
+    if (result.latencies.empty())
+    {
+        return;
+    }
+
+    auto total = 0.0;
+    for (auto latency : result.latencies)
+    {
+        total += latency;
+    }
+
+    fmt::print("{}: {} tiles, {:.1f} KiB, decode mean {:.3f}ms, p50 {:.3f}ms, p90 {:.3f}ms, max "
+               "{:.3f}ms\n",
+               name,
+               result.latencies.size(),
+               result.bytes / 1024.0,
+               total / result.latencies.size(),
+               Percentile(result.latencies, 50),
+               Percentile(result.latencies, 90),
+               Percentile(result.latencies, 100));
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    const char* map_file = "map.bin";
+    unsigned count = std::numeric_limits<unsigned>::max();
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:n:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+            map_file = optarg;
+            break;
+        case 'n':
+            count = std::stoul(optarg);
+            break;
+        default:
+            fmt::print("Usage: {} [-m map.bin] [-n count]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    auto fd = open(map_file, O_RDONLY);
+    if (fd < 0)
+    {
+        fmt::print("Failed to open {}\n", map_file);
+        return 1;
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+    auto mmap_bin = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mmap_bin == MAP_FAILED)
+    {
+        fmt::print("Failed to map {}\n", map_file);
+        return 1;
+    }
+
+    auto map_metadata = reinterpret_cast<const MapMetadata*>(mmap_bin);
+    if (static_cast<size_t>(st.st_size) < sizeof(MapMetadata) ||
+        map_metadata->magic != kMetadataMagic)
+    {
+        fmt::print("{} is not a map of this version, rebuild it with tiler.py\n", map_file);
+        return 1;
+    }
+    auto map_data = reinterpret_cast<const uint8_t*>(mmap_bin);
+    auto flash_tiles =
+        reinterpret_cast<const FlashTile*>(map_data + map_metadata->tile_data_offset);
+
+    CodecResult png;
+    CodecResult rle;
+    DecodedTile tile;
+    auto failed = 0u;
+
+    tile.indices.resize(kTileSize * kTileSize);
+
+    for (auto i = 0u; i < std::min(count, map_metadata->tile_count); i++)
+    {
+        auto data = std::span<const uint8_t>(map_data + flash_tiles[i].flash_offset,
+                                             flash_tiles[i].size);
+        auto decode_rle = [&tile](auto rle_data) {
+            return DecodeRleTile(rle_data, tile.palette, tile.indices);
+        };
+
+        if (IsRleTile(data))
+        {
+            failed += !Measure(rle, data, decode_rle);
+            continue;
+        }
+
+        if (!Measure(png, data, [&tile](auto png_data) { return DecodePng(png_data, tile); }))
+        {
+            failed++;
+            continue;
+        }
+
+        // The same tile as tiler.py --rle writes it
+        const auto colors = *std::ranges::max_element(tile.indices) + 1;
+        const auto encoded = EncodeRleTile(
+            kTileSize, kTileSize, std::span(tile.palette).first(colors), tile.indices);
+
+        failed += !Measure(rle, encoded, decode_rle);
+    }
+
+    fmt::print("{}: {} tiles, {} failed to decode\n", map_file, map_metadata->tile_count, failed);
+    Report("png", png);
+    Report("rle", rle);
+
+    if (!png.latencies.empty() && !rle.latencies.empty())
+    {
+        auto png_total = 0.0;
+        auto rle_total = 0.0;
+
+        for (auto i = 0u; i < png.latencies.size(); i++)
+        {
+            png_total += png.latencies[i];
+        }
+        for (auto i = 0u; i < rle.latencies.size(); i++)
+        {
+            rle_total += rle.latencies[i];
+        }
+        fmt::print("rle decodes {:.1f}x faster, at {:.2f}x the size\n",
+                   png_total / rle_total,
+                   static_cast<double>(rle.bytes) / png.bytes);
+    }
+
+    munmap(mmap_bin, st.st_size);
+
+    return 0;
+}
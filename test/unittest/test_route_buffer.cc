@@ -0,0 +1,136 @@
+#include "route_buffer.hh"
+#include "test.hh"
+
+#include <array>
+
+namespace
+{
+
+auto
+AsVector(const RouteBuffer& buffer)
+{
+    auto span = buffer.Span();
+
+    return std::vector(span.begin(), span.end());
+}
+
+} // namespace
+
+TEST_CASE("a default constructed route buffer is empty")
+{
+    RouteBuffer buffer;
+    REQUIRE(buffer.Span().empty());
+
+    auto copy = buffer;
+    REQUIRE(copy.Span().empty());
+}
+
+TEST_CASE("copied route buffers share the route and count the references")
+{
+    RouteArena arena(2, 4);
+
+    REQUIRE(arena.FreeCount() == 2);
+
+    auto buffer = arena.Allocate(std::array<IndexType, 3> {1, 2, 3});
+    REQUIRE(AsVector(buffer) == std::vector<IndexType> {1, 2, 3});
+    REQUIRE(arena.FreeCount() == 1);
+
+    auto copy = buffer;
+    REQUIRE(copy.Span().data() == buffer.Span().data());
+
+    buffer = RouteBuffer();
+    REQUIRE(arena.FreeCount() == 1);
+    REQUIRE(AsVector(copy) == std::vector<IndexType> {1, 2, 3});
+
+    copy = RouteBuffer();
+    REQUIRE(arena.FreeCount() == 2);
+}
+
+TEST_CASE("moved route buffers keep the reference")
+{
+    RouteArena arena(2, 4);
+
+    auto buffer = arena.Allocate(std::array<IndexType, 3> {1, 2, 3});
+    auto moved = std::move(buffer);
+    REQUIRE(buffer.Span().empty());
+    REQUIRE(AsVector(moved) == std::vector<IndexType> {1, 2, 3});
+    REQUIRE(arena.FreeCount() == 1);
+
+    RouteBuffer assigned;
+    assigned = std::move(moved);
+    REQUIRE(moved.Span().empty());
+    REQUIRE(AsVector(assigned) == std::vector<IndexType> {1, 2, 3});
+    REQUIRE(arena.FreeCount() == 1);
+
+    assigned = RouteBuffer();
+    REQUIRE(arena.FreeCount() == 2);
+}
+
+TEST_CASE("a route buffer assigned over another releases the old one")
+{
+    RouteArena arena(2, 4);
+
+    auto buffer = arena.Allocate(std::array<IndexType, 3> {1, 2, 3});
+    auto other = arena.Allocate(std::array<IndexType, 1> {4});
+    REQUIRE(arena.FreeCount() == 0);
+
+    other = buffer;
+    REQUIRE(arena.FreeCount() == 1);
+    REQUIRE(other.Span().data() == buffer.Span().data());
+
+    // Also to itself
+    const auto& same = other;
+    other = same;
+    REQUIRE(AsVector(other) == std::vector<IndexType> {1, 2, 3});
+    REQUIRE(arena.FreeCount() == 1);
+}
+
+TEST_CASE("the route arena reuses a buffer after the last reference is released")
+{
+    RouteArena arena(1, 4);
+
+    auto buffer = arena.Allocate(std::array<IndexType, 2> {1, 2});
+    const auto data = buffer.Span().data();
+
+    {
+        auto copy = buffer;
+        buffer = RouteBuffer();
+        REQUIRE(arena.FreeCount() == 0);
+    }
+    REQUIRE(arena.FreeCount() == 1);
+
+    buffer = arena.Allocate(std::array<IndexType, 3> {4, 5, 6});
+    REQUIRE(buffer.Span().data() == data);
+    REQUIRE(AsVector(buffer) == std::vector<IndexType> {4, 5, 6});
+}
+
+TEST_CASE("the route arena puts routes too long for its buffers on the heap")
+{
+    RouteArena arena(1, 4);
+
+    auto buffer = arena.Allocate(std::array<IndexType, 5> {1, 2, 3, 4, 5});
+    REQUIRE(AsVector(buffer) == std::vector<IndexType> {1, 2, 3, 4, 5});
+    REQUIRE(arena.FreeCount() == 1);
+
+    auto copy = buffer;
+    buffer = RouteBuffer();
+    REQUIRE(AsVector(copy) == std::vector<IndexType> {1, 2, 3, 4, 5});
+}
+
+TEST_CASE("the route arena puts routes on the heap when all buffers are taken")
+{
+    RouteArena arena(1, 4);
+
+    auto taken = arena.Allocate(std::array<IndexType, 1> {1});
+    REQUIRE(arena.FreeCount() == 0);
+
+    auto buffer = arena.Allocate(std::array<IndexType, 2> {2, 3});
+    REQUIRE(AsVector(buffer) == std::vector<IndexType> {2, 3});
+    REQUIRE(buffer.Span().data() != taken.Span().data());
+
+    // Freed on its own, without giving the arena another buffer
+    buffer = RouteBuffer();
+    REQUIRE(arena.FreeCount() == 0);
+    taken = RouteBuffer();
+    REQUIRE(arena.FreeCount() == 1);
+}
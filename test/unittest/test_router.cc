@@ -1,3 +1,4 @@
+#include "route_cache.hh"
 #include "route_iterator.hh"
 #include "route_utils.hh"
 #include "router.hh"
@@ -5,6 +6,7 @@
 
 #include <fmt/format.h>
 #include <set>
+#include <tuple>
 
 constexpr auto kRowSize = 16;
 
@@ -43,6 +45,14 @@ ToXY(auto index)
     return Point {index % kRowSize, index / kRowSize};
 }
 
+// For land masks built in the tests, width cells per row
+void
+SetLand(std::vector<uint32_t>& land_mask, unsigned width, unsigned x, unsigned y)
+{
+    auto index = y * width + x;
+    land_mask[index / 32] |= 1u << (index % 32);
+}
+
 
 } // namespace
 
@@ -144,6 +154,25 @@ TEST_CASE_FIXTURE(Fixture, "when walled in, the router can't find a path")
 }
 
 
+TEST_CASE_FIXTURE(Fixture, "the router knows about separate bodies of water without searching")
+{
+    // Walled in at 13..15, 6..7
+    auto r0 = router->CalculateRoute(ToPoint(0, 0), ToPoint(14, 7));
+    REQUIRE(r0.empty());
+    REQUIRE(router->GetStats().nodes_expanded == 0);
+
+    std::vector<IndexType> destinations = {ToIndex(14, 7), ToIndex(2, 0)};
+    auto routes = router->CalculateRoutes(ToIndex(0, 0), destinations);
+    REQUIRE(routes[0].empty());
+    REQUIRE_FALSE(routes[1].empty());
+
+    // On land, between the two, so moved to the reachable side
+    auto r1 = AsVector(router->CalculateRoute(ToPoint(9, 7), ToPoint(13, 5)));
+    REQUIRE_FALSE(r1.empty());
+    REQUIRE(r1.back() == ToIndex(13, 4));
+}
+
+
 TEST_CASE_FIXTURE(Fixture, "the router can merge partial paths")
 {
     auto r0 = router->CalculateRoute(ToPoint(0, 7), ToPoint(0, 5));
@@ -184,6 +213,659 @@ TEST_CASE_FIXTURE(Fixture, "the router reports only direction changes in it's pa
 }
 
 
+TEST_CASE_FIXTURE(Fixture, "the router gives the same result when reused")
+{
+    auto r0 = AsVector(router->CalculateRoute(ToPoint(0, 0), ToPoint(9, 1)));
+    auto expanded = router->GetStats().nodes_expanded;
+
+    // Nodes left from other searches must not be visible
+    for (auto i = 0; i < 3; i++)
+    {
+        REQUIRE(router->CalculateRoute(ToPoint(15, 8), ToPoint(4, 8)).empty());
+        REQUIRE_FALSE(router->CalculateRoute(ToPoint(9, 1), ToPoint(0, 0)).empty());
+
+        REQUIRE(AsVector(router->CalculateRoute(ToPoint(0, 0), ToPoint(9, 1))) == r0);
+        REQUIRE(router->GetStats().nodes_expanded == expanded);
+    }
+}
+
+
+TEST_CASE_FIXTURE(Fixture, "the router reports how much of the node cache it used")
+{
+    REQUIRE_FALSE(router->CalculateRoute(ToPoint(0, 0), ToPoint(5, 0)).empty());
+    auto stats = router->GetStats();
+
+    REQUIRE(stats.nodes_used > 0);
+    REQUIRE(stats.nodes_used <= kUnitTestCacheSize);
+    REQUIRE(stats.open_set_high_water > 0);
+    REQUIRE(stats.open_set_high_water <= stats.nodes_used);
+    REQUIRE(router->SearchMemory() > stats.nodes_used * sizeof(void*));
+
+    // Separate bodies of water, so nothing searched
+    REQUIRE(router->CalculateRoute(ToPoint(0, 0), ToPoint(14, 7)).empty());
+    REQUIRE(router->GetStats().nodes_used == 0);
+    REQUIRE(router->GetStats().open_set_high_water == 0);
+    REQUIRE(router->SearchMemory() == 0);
+}
+
+TEST_CASE_FIXTURE(Fixture, "the jump point search engine finds the same paths")
+{
+    router->SetEngine(Router<kUnitTestCacheSize>::Engine::kJumpPointSearch);
+
+    auto r0 = router->CalculateRoute(ToPoint(0, 0), ToPoint(0, 1));
+    REQUIRE_FALSE(r0.empty());
+
+    r0 = router->CalculateRoute(ToPoint(0, 0), ToPoint(3, 3));
+    REQUIRE(AsSet(r0) == AsSet(std::array {ToIndex(0, 0), ToIndex(3, 3)}));
+
+    r0 = router->CalculateRoute(ToPoint(0, 0), ToPoint(5, 0));
+    REQUIRE(AsVector(r0) == AsVector(std::array {ToIndex(0, 0), ToIndex(5, 0)}));
+
+    r0 = router->CalculateRoute(ToPoint(15, 8), ToPoint(4, 8));
+    REQUIRE(r0.empty());
+}
+
+
+TEST_CASE("the router keeps a distance from the coast")
+{
+    constexpr auto kWidth = 32;
+    constexpr auto kHeight = 16;
+
+    // Land on the two top rows
+    std::vector<uint32_t> land_mask(kWidth * kHeight / 32, 0);
+    land_mask[0] = 0xffffffff;
+    land_mask[1] = 0xffffffff;
+
+    auto router = std::make_unique<Router<kTargetCacheSize>>(land_mask, kHeight, kWidth);
+
+    // Two cells from land, so a detour further out is cheaper than following the coast
+    auto r0 = router->CalculateRoute(static_cast<IndexType>(3 * kWidth + 2),
+                                     static_cast<IndexType>(3 * kWidth + 29));
+    REQUIRE(r0.size() > 2);
+    for (auto index : r0.subspan(1, r0.size() - 2))
+    {
+        REQUIRE(index / kWidth >= 4);
+    }
+}
+
+
+TEST_CASE("the router starts and ends on the closest water when given land")
+{
+    constexpr auto kSize = 64;
+
+    // Land, with a lake to the upper right and a pond to the upper left
+    std::vector<uint32_t> land_mask(kSize * kSize / 32, 0xffffffff);
+    for (auto [x0, y0, x1, y1] : {std::tuple {40, 5, 59, 20}, {5, 5, 8, 8}})
+    {
+        for (auto y = y0; y <= y1; y++)
+        {
+            for (auto x = x0; x <= x1; x++)
+            {
+                land_mask[(y * kSize + x) / 32] &= ~(1u << (x % 32));
+            }
+        }
+    }
+
+    auto router = std::make_unique<Router<kTargetCacheSize>>(land_mask, kSize, kSize);
+    auto index = [](auto x, auto y) { return static_cast<IndexType>(y * kSize + x); };
+
+    // Far away, to the lower left of the lake (the pond is a bit closer, but not reachable)
+    auto r0 = router->CalculateRoute(index(63, 0), index(14, 40));
+    REQUIRE(r0.size() >= 2);
+    REQUIRE(r0.front() == index(59, 5));
+    REQUIRE(r0.back() == index(40, 20));
+
+    // Up and to the right
+    auto r1 = router->CalculateRoute(index(2, 10), index(7, 7));
+    REQUIRE(r1.size() >= 2);
+    REQUIRE(r1.front() == index(5, 8));
+}
+
+
+TEST_CASE("the router repairs a route locally when leaving it")
+{
+    constexpr auto kSize = 96;
+
+    // An island in the middle
+    std::vector<uint32_t> land_mask(kSize * kSize / 32, 0);
+    for (auto y = 40; y < 56; y++)
+    {
+        for (auto x = 40; x < 56; x++)
+        {
+            SetLand(land_mask, kSize, x, y);
+        }
+    }
+
+    auto router = std::make_unique<Router<kTargetCacheSize>>(land_mask, kSize, kSize);
+    auto from = static_cast<IndexType>(8 * kSize + 8);
+    auto to = static_cast<IndexType>(88 * kSize + 88);
+
+    auto route = AsVector(router->CalculateRoute(from, to));
+    REQUIRE(route.size() >= 2);
+
+    // On the route
+    REQUIRE(router->DistanceToRoute(from, route) == 0);
+    REQUIRE(router->DistanceToRoute(to, route) == 0);
+
+    // Off to the side, some way along the route
+    auto off_route = static_cast<IndexType>(20 * kSize + 4);
+    REQUIRE(router->DistanceToRoute(off_route, route) > 3);
+
+    auto repaired = AsVector(router->RepairRoute(off_route, route));
+    REQUIRE(repaired.size() >= 2);
+    REQUIRE(repaired.front() == off_route);
+    REQUIRE(repaired.back() == to);
+    REQUIRE(router->DistanceToRoute(off_route, repaired) == 0);
+    auto repair_expanded = router->GetStats().nodes_expanded;
+
+    REQUIRE_FALSE(router->CalculateRoute(off_route, to).empty());
+    REQUIRE(repair_expanded < router->GetStats().nodes_expanded);
+
+    // Too far from a route along the top, so the full search is left to the caller
+    auto top_route = AsVector(router->CalculateRoute(static_cast<IndexType>(4 * kSize + 8),
+                                                     static_cast<IndexType>(4 * kSize + 88)));
+    auto far_away = static_cast<IndexType>(88 * kSize + 4);
+    REQUIRE(router->DistanceToRoute(far_away, top_route) > kMaxRepairDistance);
+    REQUIRE(router->RepairRoute(far_away, top_route).empty());
+    REQUIRE(router->GetStats().nodes_expanded == 0);
+}
+
+
+TEST_CASE("the router finds routes to several destinations with one search")
+{
+    constexpr auto kSize = 96;
+
+    // An island in the middle, and a walled in spot in the corner
+    std::vector<uint32_t> land_mask(kSize * kSize / 32, 0);
+    for (auto y = 40; y < 56; y++)
+    {
+        for (auto x = 40; x < 56; x++)
+        {
+            SetLand(land_mask, kSize, x, y);
+        }
+    }
+    for (auto i = 0; i < 3; i++)
+    {
+        SetLand(land_mask, kSize, 84 + i, 4);
+        SetLand(land_mask, kSize, 84 + i, 6);
+        SetLand(land_mask, kSize, 84, 4 + i);
+        SetLand(land_mask, kSize, 86, 4 + i);
+    }
+
+    auto router = std::make_unique<Router<kTargetCacheSize>>(land_mask, kSize, kSize);
+    auto from = static_cast<IndexType>(8 * kSize + 8);
+    std::vector<IndexType> destinations = {static_cast<IndexType>(88 * kSize + 88),
+                                           static_cast<IndexType>(60 * kSize + 70),
+                                           static_cast<IndexType>(80 * kSize + 12)};
+
+    auto separate_expanded = 0u;
+    std::vector<CostType> separate_costs;
+    for (auto destination : destinations)
+    {
+        auto route = router->CalculateRoute(from, destination);
+        REQUIRE_FALSE(route.empty());
+        separate_expanded += router->GetStats().nodes_expanded;
+        separate_costs.push_back(router->RouteCost(route));
+    }
+
+    auto routes = router->CalculateRoutes(from, destinations);
+    REQUIRE(routes.size() == destinations.size());
+    for (auto i = 0u; i < destinations.size(); i++)
+    {
+        REQUIRE(routes[i].size() >= 2);
+        REQUIRE(routes[i].front() == from);
+        REQUIRE(routes[i].back() == destinations[i]);
+        // Still the cheapest, also after the closer targets have been reached
+        REQUIRE(router->RouteCost(routes[i]) == separate_costs[i]);
+    }
+    REQUIRE(router->GetStats().nodes_expanded < separate_expanded);
+
+    // The walled in destination is left empty
+    destinations.push_back(static_cast<IndexType>(5 * kSize + 85));
+    routes = router->CalculateRoutes(from, destinations);
+    REQUIRE(routes.size() == destinations.size());
+    REQUIRE(routes[0].back() == destinations[0]);
+    REQUIRE(routes[3].empty());
+}
+
+
+TEST_CASE("the router straightens routes with line of sight")
+{
+    constexpr auto kSize = 64;
+
+    // An island in the middle, and land on the two top rows
+    std::vector<uint32_t> land_mask(kSize * kSize / 32, 0);
+    auto is_land = [](auto x, auto y) {
+        return y < 2 || (x >= 24 && x < 40 && y >= 24 && y < 40);
+    };
+    for (auto y = 0; y < kSize; y++)
+    {
+        for (auto x = 0; x < kSize; x++)
+        {
+            if (is_land(x, y))
+            {
+                SetLand(land_mask, kSize, x, y);
+            }
+        }
+    }
+
+    auto router = std::make_unique<Router<kTargetCacheSize>>(land_mask, kSize, kSize);
+
+    // Not along one of the 8 directions
+    auto from = static_cast<IndexType>(44 * kSize + 4);
+    auto to = static_cast<IndexType>(60 * kSize + 60);
+    auto plain = AsVector(router->CalculateRoute(from, to));
+    REQUIRE(plain.size() > 2);
+
+    router->SetSmoothing(true);
+    auto smoothed = AsVector(router->CalculateRoute(from, to));
+    REQUIRE(smoothed == std::vector<IndexType> {from, to});
+
+    // Around the island, without crossing land
+    from = static_cast<IndexType>(20 * kSize + 20);
+    to = static_cast<IndexType>(44 * kSize + 44);
+    smoothed = AsVector(router->CalculateRoute(from, to));
+    REQUIRE(smoothed.size() >= 3);
+    REQUIRE(smoothed.front() == from);
+    REQUIRE(smoothed.back() == to);
+    for (auto i = 0u; i + 1 < smoothed.size(); i++)
+    {
+        int x0 = smoothed[i] % kSize;
+        int y0 = smoothed[i] / kSize;
+        int x1 = smoothed[i + 1] % kSize;
+        int y1 = smoothed[i + 1] / kSize;
+
+        for (auto step = 0; step <= 64; step++)
+        {
+            REQUIRE_FALSE(is_land((x0 * (64 - step) + x1 * step) / 64,
+                                  (y0 * (64 - step) + y1 * step) / 64));
+        }
+    }
+
+    // Still keeping a distance from the coast
+    from = static_cast<IndexType>(3 * kSize + 2);
+    to = static_cast<IndexType>(3 * kSize + 29);
+    smoothed = AsVector(router->CalculateRoute(from, to));
+    REQUIRE(smoothed.size() > 2);
+    for (auto index : std::span(smoothed).subspan(1, smoothed.size() - 2))
+    {
+        REQUIRE(index / kSize >= 4);
+    }
+}
+
+
+TEST_CASE("the landmark heuristic expands fewer nodes")
+{
+    constexpr auto kSize = 96;
+
+    // A long wall with a passage at the bottom, and a bay on the near side of it
+    std::vector<uint32_t> land_mask(kSize * kSize / 32, 0);
+    for (auto y = 0; y < 88; y++)
+    {
+        SetLand(land_mask, kSize, 48, y);
+    }
+    for (auto x = 24; x < 48; x++)
+    {
+        SetLand(land_mask, kSize, x, 60);
+    }
+
+    auto router = std::make_unique<Router<kTargetCacheSize>>(land_mask, kSize, kSize);
+    auto data = BuildLandmarks(LandMask(land_mask, kSize, kSize));
+    Landmarks landmarks(data);
+    REQUIRE(landmarks.IsValid());
+    REQUIRE(landmarks.Count() == kLandmarkCount);
+
+    auto from = static_cast<IndexType>(30 * kSize + 30);
+    auto to = static_cast<IndexType>(30 * kSize + 70);
+
+    REQUIRE_FALSE(router->CalculateRoute(from, to).empty());
+    auto plain_expanded = router->GetStats().nodes_expanded;
+    REQUIRE(router->GetStats().landmarks == 0);
+
+    router->SetLandmarks(&landmarks);
+    auto r1 = AsVector(router->CalculateRoute(from, to));
+    REQUIRE(router->GetStats().landmarks > 0);
+    REQUIRE(r1.front() == from);
+    REQUIRE(r1.back() == to);
+    REQUIRE(router->GetStats().nodes_expanded < plain_expanded / 2);
+
+    // Built for another map
+    auto small_data = BuildLandmarks(LandMask(land_mask, kSize, kSize / 2));
+    Landmarks small_landmarks(small_data);
+    REQUIRE(small_landmarks.IsValid());
+    REQUIRE_FALSE(small_landmarks.Matches(kSize, kSize));
+    router->SetLandmarks(&small_landmarks);
+    REQUIRE_FALSE(router->CalculateRoute(from, to).empty());
+    REQUIRE(router->GetStats().landmarks == 0);
+
+    // A block count which wraps around in 32 bits
+    auto corrupt = data;
+    corrupt[2] = 0x10000;
+    corrupt[3] = 0x10000;
+    REQUIRE_FALSE(Landmarks(corrupt).IsValid());
+}
+
+
+TEST_CASE("bidirectional A* meets in the middle")
+{
+    constexpr auto kSize = 96;
+
+    // Open water with a few round islands
+    std::vector<uint32_t> land_mask(kSize * kSize / 32, 0);
+    for (auto [cx, cy, r] : {std::tuple {30, 30, 8}, {60, 55, 10}, {40, 75, 6}})
+    {
+        for (auto y = cy - r; y <= cy + r; y++)
+        {
+            for (auto x = cx - r; x <= cx + r; x++)
+            {
+                if ((x - cx) * (x - cx) + (y - cy) * (y - cy) <= r * r)
+                {
+                    SetLand(land_mask, kSize, x, y);
+                }
+            }
+        }
+    }
+
+    auto astar = std::make_unique<Router<kTargetCacheSize>>(land_mask, kSize, kSize);
+    auto bidirectional = std::make_unique<Router<kTargetCacheSize>>(
+        land_mask, kSize, kSize, Router<kTargetCacheSize>::Engine::kBidirectional);
+
+    auto from = static_cast<IndexType>(5 * kSize + 5);
+    auto to = static_cast<IndexType>(90 * kSize + 90);
+
+    REQUIRE_FALSE(astar->CalculateRoute(from, to).empty());
+
+    auto r0 = AsVector(bidirectional->CalculateRoute(from, to));
+    REQUIRE(r0.size() >= 3);
+    REQUIRE(r0.front() == from);
+    REQUIRE(r0.back() == to);
+    REQUIRE(bidirectional->GetStats().partial_paths == 0);
+    REQUIRE(bidirectional->GetStats().nodes_expanded < astar->GetStats().nodes_expanded / 2);
+
+    // The other way around
+    auto r1 = AsVector(bidirectional->CalculateRoute(to, from));
+    REQUIRE(r1.front() == to);
+    REQUIRE(r1.back() == from);
+
+    // The node cache runs out over open water, so it continues with partial paths
+    std::vector<uint32_t> open_water(64 * 64 / 32, 0);
+    Router<kUnitTestCacheSize> small(
+        open_water, 64, 64, Router<kUnitTestCacheSize>::Engine::kBidirectional);
+
+    auto r2 = AsVector(small.CalculateRoute(4 * 64 + 4, 40 * 64 + 60));
+    REQUIRE(r2.size() >= 2);
+    REQUIRE(r2.front() == 4 * 64 + 4);
+    REQUIRE(r2.back() == 40 * 64 + 60);
+    REQUIRE(small.GetStats().partial_paths > 0);
+
+    // Not even room for the first expansions from both ends, which is no reason to give up
+    Router<kUnitTestTinyCacheSize> tiny(
+        open_water, 64, 64, Router<kUnitTestTinyCacheSize>::Engine::kBidirectional);
+
+    auto r3 = AsVector(tiny.CalculateRoute(4 * 64 + 4, 12 * 64 + 16));
+    REQUIRE(r3.size() >= 2);
+    REQUIRE(r3.front() == 4 * 64 + 4);
+    REQUIRE(r3.back() == 12 * 64 + 16);
+}
+
+
+TEST_CASE("weighted A* expands fewer nodes")
+{
+    constexpr auto kSize = 96;
+
+    std::vector<uint32_t> land_mask(kSize * kSize / 32, 0);
+    for (auto y = 10; y < 80; y++)
+    {
+        SetLand(land_mask, kSize, 48, y);
+    }
+
+    auto router = std::make_unique<Router<kTargetCacheSize>>(land_mask, kSize, kSize);
+
+    auto from = static_cast<IndexType>(40 * kSize + 5);
+    auto to = static_cast<IndexType>(50 * kSize + 90);
+
+    auto r0 = AsVector(router->CalculateRoute(from, to));
+    auto optimal_expanded = router->GetStats().nodes_expanded;
+
+    router->SetHeuristicWeight(300);
+    auto r1 = AsVector(router->CalculateRoute(from, to));
+    REQUIRE(r1.front() == from);
+    REQUIRE(r1.back() == to);
+    REQUIRE(router->GetStats().nodes_expanded < optimal_expanded / 3);
+
+    // And back to the cheapest
+    router->SetHeuristicWeight(100);
+    REQUIRE(AsVector(router->CalculateRoute(from, to)) == r0);
+    REQUIRE(router->GetStats().nodes_expanded == optimal_expanded);
+    REQUIRE_FALSE(router->GetStats().expansion_limit_reached);
+
+    // Gives up when the search takes too long
+    router->SetExpansionLimit(optimal_expanded / 2);
+    REQUIRE(router->CalculateRoute(from, to).empty());
+    REQUIRE(router->GetStats().expansion_limit_reached);
+    REQUIRE(router->GetStats().nodes_expanded <= optimal_expanded / 2 + 8);
+
+    router->SetExpansionLimit(0);
+    REQUIRE(AsVector(router->CalculateRoute(from, to)) == r0);
+
+    // Or when the time is up, which is only asked now and then
+    auto time_checks = 0u;
+    router->SetTimeLimit([&time_checks]() { return ++time_checks == 3; });
+    REQUIRE(router->CalculateRoute(from, to).empty());
+    REQUIRE(router->GetStats().expansion_limit_reached);
+    REQUIRE(time_checks == 3);
+    REQUIRE(router->GetStats().nodes_expanded <= 3 * kTimeLimitCheckInterval * 8);
+
+    router->SetTimeLimit({});
+    REQUIRE(AsVector(router->CalculateRoute(from, to)) == r0);
+}
+
+
+TEST_CASE("the block-sparse land mask gives the same routes")
+{
+    // Not a multiple of the block size, with open water, a large island and a small one
+    constexpr auto kWidth = 200;
+    constexpr auto kHeight = 150;
+
+    std::vector<uint32_t> land_mask((kWidth * kHeight + 31) / 32, 0);
+    for (auto [cx, cy, r] : {std::tuple {120, 80, 40}, {30, 120, 5}})
+    {
+        for (auto y = cy - r; y <= cy + r; y++)
+        {
+            for (auto x = cx - r; x <= cx + r; x++)
+            {
+                if ((x - cx) * (x - cx) + (y - cy) * (y - cy) <= r * r)
+                {
+                    SetLand(land_mask, kWidth, x, y);
+                }
+            }
+        }
+    }
+
+    auto data = BuildBlockLandMask(land_mask, kWidth, kHeight);
+    LandMask blocks(data);
+    REQUIRE(blocks.IsValid());
+    REQUIRE(blocks.Width() == kWidth);
+    REQUIRE(blocks.Height() == kHeight);
+    REQUIRE(blocks.DataSize() < land_mask.size() * sizeof(uint32_t));
+
+    for (auto i = 0u; i < kWidth * kHeight; i++)
+    {
+        REQUIRE(blocks.IsWater(i) == IsWater(land_mask, i));
+    }
+    REQUIRE_FALSE(blocks.IsWater(kWidth * kHeight));
+
+    // Corrupt data is not used
+    auto corrupt = data;
+    corrupt.resize(corrupt.size() - 1);
+    REQUIRE_FALSE(LandMask(corrupt).IsValid());
+
+    // A block count which wraps around in 32 bits
+    corrupt = data;
+    corrupt[3] = 0x10000;
+    corrupt[4] = 0x10000;
+    REQUIRE_FALSE(LandMask(corrupt).IsValid());
+
+    // A bitmap offset into the header
+    corrupt = data;
+    auto mixed = std::ranges::find_if(corrupt.begin() + 6, corrupt.end(), [](auto entry) {
+        return entry != kAllWaterBlock && entry != kAllLandBlock;
+    });
+    REQUIRE(mixed != corrupt.end());
+    *mixed = 2;
+    REQUIRE_FALSE(LandMask(corrupt).IsValid());
+
+    auto from = static_cast<IndexType>(10 * kWidth + 10);
+    auto to = static_cast<IndexType>(140 * kWidth + 190);
+
+    for (auto engine : {Router<kTargetCacheSize>::Engine::kAstar,
+                        Router<kTargetCacheSize>::Engine::kJumpPointSearch})
+    {
+        auto plain_router =
+            std::make_unique<Router<kTargetCacheSize>>(land_mask, kHeight, kWidth, engine);
+        auto block_router = std::make_unique<Router<kTargetCacheSize>>(blocks, engine);
+
+        auto r0 = AsVector(plain_router->CalculateRoute(from, to));
+        auto r1 = AsVector(block_router->CalculateRoute(from, to));
+        REQUIRE(r0.size() >= 2);
+        REQUIRE(r0 == r1);
+        REQUIRE(plain_router->GetStats().nodes_expanded == block_router->GetStats().nodes_expanded);
+    }
+}
+
+
+TEST_CASE("the block-sparse land mask is built as by tiler.py")
+{
+    // Two blocks wide and high: all land, mixed along the right edge, all water, and mixed with
+    // a single land cell in the bottom right corner
+    constexpr auto kWidth = 40;
+    constexpr auto kHeight = 36;
+
+    std::vector<uint32_t> land_mask((kWidth * kHeight + 31) / 32, 0);
+    for (auto y = 0; y < 32; y++)
+    {
+        for (auto x = 0; x < 32; x++)
+        {
+            SetLand(land_mask, kWidth, x, y);
+        }
+    }
+    for (auto y = 0; y < 2; y++)
+    {
+        for (auto x = 32; x < 36; x++)
+        {
+            SetLand(land_mask, kWidth, x, y);
+        }
+    }
+    SetLand(land_mask, kWidth, 39, 35);
+
+    // The output of create_block_land_mask() in tools/tiler.py for the same land mask: the
+    // header, the table and the two mixed bitmaps
+    const std::vector<uint32_t> tiler_output = {
+        0x4b4d4c42, 40, 36, 2, 2, 2, 1, 10, 0, 42,
+        0xf, 0xf, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+    REQUIRE(BuildBlockLandMask(land_mask, kWidth, kHeight) == tiler_output);
+    REQUIRE(LandMask(tiler_output).IsValid());
+}
+
+
+TEST_CASE("jump point search crosses open water with few nodes")
+{
+    constexpr auto kSize = 64;
+
+    // All water
+    std::vector<uint32_t> open_water(kSize * kSize / 32, 0);
+    auto from = static_cast<IndexType>(4 * kSize + 4);
+    auto to = static_cast<IndexType>(40 * kSize + 60);
+
+    Router<kUnitTestCacheSize> astar(open_water, kSize, kSize);
+    Router<kUnitTestCacheSize> jps(
+        open_water, kSize, kSize, Router<kUnitTestCacheSize>::Engine::kJumpPointSearch);
+
+    // Too far for the node cache with regular A*
+    REQUIRE_FALSE(astar.CalculateRoute(from, to).empty());
+    REQUIRE(astar.GetStats().partial_paths > 0);
+
+    auto r0 = jps.CalculateRoute(from, to);
+    REQUIRE(r0.size() >= 2);
+    REQUIRE(r0.front() == from);
+    REQUIRE(r0.back() == to);
+    REQUIRE(jps.GetStats().partial_paths == 0);
+    REQUIRE(jps.GetStats().nodes_expanded < astar.GetStats().nodes_expanded);
+}
+
+
+TEST_CASE("the abstract graph routes between clusters")
+{
+    constexpr auto kSize = 96;
+
+    // A wall between the two leftmost and the rightmost clusters, with a gap at the bottom
+    std::vector<uint32_t> land_mask(kSize * kSize / 32, 0);
+    for (auto y = 0; y < kSize - 8; y++)
+    {
+        SetLand(land_mask, kSize, 60, y);
+    }
+
+    auto router = std::make_unique<Router<kTargetCacheSize>>(land_mask, kSize, kSize);
+    auto data = BuildAbstractGraph(LandMask(land_mask, kSize, kSize));
+
+    AbstractGraph graph(data);
+    REQUIRE(graph.IsValid());
+    REQUIRE(graph.PortalCount() > 0);
+
+    auto corrupt = data;
+    corrupt[0] = 0;
+    REQUIRE_FALSE(AbstractGraph(corrupt).IsValid());
+    REQUIRE_FALSE(AbstractGraph(std::span(data).first(4)).IsValid());
+
+    // The tables after the header: first portal per cluster, portal indices, first edge per portal
+    // and the edges
+    const auto header_words = sizeof(AbstractGraphHeader) / sizeof(uint32_t);
+    const auto cluster_count = 3 * 3;
+    const auto portal_count = graph.PortalCount();
+    const auto first_edges = header_words + cluster_count + 1 + portal_count;
+
+    corrupt = data;
+    corrupt[header_words + 1] = portal_count + 1;
+    REQUIRE_FALSE(AbstractGraph(corrupt).IsValid());
+    corrupt = data;
+    corrupt[first_edges + portal_count] += 1;
+    REQUIRE_FALSE(AbstractGraph(corrupt).IsValid());
+    corrupt = data;
+    corrupt.back() = (corrupt.back() & 0xffff0000) | portal_count;
+    REQUIRE_FALSE(AbstractGraph(corrupt).IsValid());
+    corrupt = data;
+    corrupt[header_words + cluster_count + 1] = kSize * kSize;
+    REQUIRE(AbstractGraph(corrupt).IsValid());
+    REQUIRE_FALSE(AbstractGraph(corrupt).Matches(kSize, kSize));
+
+    // Built for another land mask
+    REQUIRE(graph.Matches(kSize, kSize));
+    REQUIRE_FALSE(graph.Matches(2 * kSize, kSize));
+
+    auto from = static_cast<IndexType>(4 * kSize + 4);
+    auto to = static_cast<IndexType>(4 * kSize + 90);
+
+    auto other_land_mask = std::vector<uint32_t>(2 * kSize * kSize / 32, 0);
+    auto other_router =
+        std::make_unique<Router<kTargetCacheSize>>(other_land_mask, kSize, 2 * kSize);
+    other_router->SetAbstractGraph(&graph);
+    REQUIRE(other_router->CalculateRoute(from, to).size() >= 2);
+    REQUIRE(other_router->GetStats().abstract_nodes_expanded == 0);
+
+    router->SetAbstractGraph(&graph);
+    auto r0 = router->CalculateRoute(from, to);
+    REQUIRE(r0.size() >= 2);
+    REQUIRE(r0.front() == from);
+    REQUIRE(r0.back() == to);
+    REQUIRE(router->GetStats().partial_paths == 0);
+    REQUIRE(router->GetStats().abstract_nodes_expanded > 0);
+}
+
+
 TEST_CASE_FIXTURE(Fixture, "Indices can be translated to directions")
 {
     auto d_standstill = IndexPairToDirection(ToIndex(1, 0), ToIndex(1, 0), kRowSize);
@@ -247,3 +929,35 @@ TEST_CASE_FIXTURE(Fixture, "the route iterator handles turns")
     REQUIRE(*next_it.Next() == ToPoint(6, 4));
     REQUIRE(next_it.Next() == std::nullopt);
 }
+
+TEST_CASE("the route cache keeps the most recently used routes within its budget")
+{
+    auto route_a = std::array {ToIndex(1, 1), ToIndex(12, 1)};
+    auto route_b = std::array {ToIndex(1, 9), ToIndex(5, 9), ToIndex(12, 14)};
+    auto cache = RouteCache(kRowSize, kDefaultRouteCacheBudget, 4);
+
+    cache.Insert(ToIndex(1, 1), ToIndex(12, 1), route_a);
+    cache.Insert(ToIndex(1, 9), ToIndex(12, 14), route_b);
+    REQUIRE(cache.Count() == 2);
+
+    // Close to the start and destination, in the same squares
+    REQUIRE(AsVector(cache.Lookup(ToIndex(2, 2), ToIndex(13, 0))) == AsVector(route_a));
+    REQUIRE(cache.Lookup(ToIndex(4, 1), ToIndex(12, 1)).empty());
+    REQUIRE(cache.Lookup(ToIndex(12, 1), ToIndex(1, 1)).empty());
+
+    // Room for two routes only, so the least recently used one (b) goes
+    cache.SetBudget(cache.Size());
+    cache.Insert(ToIndex(8, 8), ToIndex(0, 0), route_a);
+    REQUIRE(cache.Count() == 2);
+    REQUIRE(cache.Lookup(ToIndex(1, 9), ToIndex(12, 14)).empty());
+    REQUIRE(AsVector(cache.Lookup(ToIndex(1, 1), ToIndex(12, 1))) == AsVector(route_a));
+
+    // Replaced for the same squares
+    cache.Insert(ToIndex(0, 0), ToIndex(15, 0), route_b);
+    REQUIRE(cache.Count() == 2);
+    REQUIRE(AsVector(cache.Lookup(ToIndex(1, 1), ToIndex(12, 1))) == AsVector(route_b));
+
+    cache.SetBudget(0);
+    REQUIRE(cache.Count() == 0);
+    REQUIRE(cache.Size() == 0);
+}
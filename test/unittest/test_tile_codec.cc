@@ -0,0 +1,92 @@
+#include "test.hh"
+#include "tile_codec.hh"
+
+#include <array>
+#include <random>
+
+TEST_CASE("RLE tiles decode to the encoded palette and indices")
+{
+    constexpr auto kWidth = 40;
+    constexpr auto kHeight = 30;
+
+    std::array<uint16_t, 4> palette = {0x0000, 0xff99, 0x041f, 0xffff};
+    std::vector<uint8_t> indices(kWidth * kHeight);
+    std::mt19937 rng(1);
+
+    // Long runs, short runs and noise
+    for (auto i = 0u; i < indices.size();)
+    {
+        auto length = std::min<size_t>(rng() % 3 == 0 ? 1 + rng() % 300 : 1, indices.size() - i);
+
+        std::fill_n(&indices[i], length, rng() % palette.size());
+        i += length;
+    }
+
+    auto data = EncodeRleTile(kWidth, kHeight, palette, indices);
+    REQUIRE(IsRleTile(data));
+    REQUIRE(data.size() < indices.size());
+
+    std::array<uint16_t, 256> decoded_palette {};
+    std::vector<uint8_t> decoded_indices(kWidth * kHeight);
+
+    REQUIRE(DecodeRleTile(data, decoded_palette, decoded_indices));
+    REQUIRE(std::equal(palette.begin(), palette.end(), decoded_palette.begin()));
+    REQUIRE(decoded_indices == indices);
+
+    THEN("a tile of another size is rejected")
+    {
+        std::vector<uint8_t> too_small(kWidth * kHeight - 1);
+
+        REQUIRE_FALSE(DecodeRleTile(data, decoded_palette, too_small));
+    }
+
+    THEN("truncated data is rejected")
+    {
+        data.resize(data.size() - 1);
+
+        REQUIRE_FALSE(DecodeRleTile(data, decoded_palette, decoded_indices));
+    }
+}
+
+TEST_CASE("RLE tiles decode as written by tiler.py")
+{
+    // 3x2 pixels in two colors, as three literal indices and a run of 3 (from encode_rle_tile)
+    const std::vector<uint8_t> data = {
+        'R', 'L', 'E', 'T', 3, 0, 2, 0, 2, 0, 0x99, 0xff, 0x1f, 0x04, 2, 0, 1, 0, 128, 1};
+    // 3x2 pixels, a run of 6
+    const std::vector<uint8_t> run = {'R', 'L', 'E', 'T', 3, 0, 2, 0, 1, 0, 0x1f, 0x04, 131, 0};
+
+    std::array<uint16_t, 256> palette {};
+    std::vector<uint8_t> indices(6);
+
+    REQUIRE(DecodeRleTile(data, palette, indices));
+    REQUIRE(palette[0] == 0xff99);
+    REQUIRE(palette[1] == 0x041f);
+    REQUIRE(indices == std::vector<uint8_t> {0, 1, 0, 1, 1, 1});
+
+    REQUIRE(DecodeRleTile(run, palette, indices));
+    REQUIRE(indices == std::vector<uint8_t>(6, 0));
+
+    REQUIRE_FALSE(IsRleTile(std::vector<uint8_t> {0x89, 'P', 'N', 'G', 0, 0, 0, 0, 0, 0}));
+
+    THEN("EncodeRleTile writes the same bytes")
+    {
+        const std::array<uint16_t, 2> two_colors = {0xff99, 0x041f};
+        const std::array<uint16_t, 1> one_color = {0x041f};
+        const std::vector<uint8_t> mixed = {0, 1, 0, 1, 1, 1};
+        const std::vector<uint8_t> same(6, 0);
+
+        REQUIRE(EncodeRleTile(3, 2, two_colors, mixed) == data);
+        REQUIRE(EncodeRleTile(3, 2, one_color, same) == run);
+    }
+
+    THEN("repeated indices as literals decode too")
+    {
+        // Not written by tiler.py, which makes runs of 3 or more
+        const std::vector<uint8_t> literals = {
+            'R', 'L', 'E', 'T', 3, 0, 2, 0, 2, 0, 0x99, 0xff, 0x1f, 0x04, 5, 0, 1, 0, 1, 1, 1};
+
+        REQUIRE(DecodeRleTile(literals, palette, indices));
+        REQUIRE(indices == std::vector<uint8_t> {0, 1, 0, 1, 1, 1});
+    }
+}
@@ -4,6 +4,7 @@ import os
 import sys
 import struct
 import io
+import itertools
 import yaml
 
 import PIL
@@ -14,6 +15,9 @@ PIL.Image.MAX_IMAGE_PIXELS = 933120000
 
 kGpsTileSize = 256
 
+kTileCodecPng = 0
+kTileCodecRle = 1
+
 
 def get_tile_positions_to_ignore(yaml_data: dict, img: Image, tile_size: int):
     out = {}
@@ -72,6 +76,98 @@ def create_tiles(yaml_data: dict, img: Image, to_ignore: dict, tile_size: int):
     return tiles
 
 
+def encode_rle_tile(tile: Image):
+    # See tile_codec.hh: the header, the palette as RGB565 and the indices as runs. Much faster to
+    # decode than a PNG
+    indices = tile.tobytes()
+    palette = tile.getpalette()[: (max(indices) + 1) * 3]
+
+    out = bytearray(struct.pack("<IHHH", 0x54454C52, tile.size[0], tile.size[1], len(palette) // 3))
+    for i in range(0, len(palette), 3):
+        r, g, b = palette[i : i + 3]
+        out += struct.pack("<H", ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3))
+
+    literals = bytearray()
+
+    def flush_literals():
+        for i in range(0, len(literals), 128):
+            chunk = literals[i : i + 128]
+            out.append(len(chunk) - 1)
+            out.extend(chunk)
+        literals.clear()
+
+    for index, group in itertools.groupby(indices):
+        length = len(list(group))
+
+        while length >= 3:
+            run = min(length, 130)
+            flush_literals()
+            out += bytes([run + 125, index])
+            length -= run
+        literals.extend([index] * length)
+    flush_literals()
+
+    return bytes(out)
+
+
+def encode_tile(tile: Image, codec: int):
+    if codec == kTileCodecRle:
+        return encode_rle_tile(tile)
+
+    output = io.BytesIO()
+    tile.save(output, format="PNG")
+
+    return output.getvalue()
+
+
+def create_block_land_mask(land_mask: bytes, width: int, height: int):
+    # The block-sparse land mask (see land_mask.hh): a table with a flag for all-water and
+    # all-land blocks, and 32x32 bitmaps for the mixed ones. test_router.cc has an output of this
+    # to check BuildBlockLandMask() against, so regenerate it there if the format changes
+    block_size = 32
+    block_row_size = (width + block_size - 1) // block_size
+    block_rows = (height + block_size - 1) // block_size
+    bitmaps_start = 6 + block_row_size * block_rows
+
+    mask = int.from_bytes(land_mask, "little")
+    rows = []
+    for y in range(0, height):
+        rows.append((mask >> (y * width)) & ((1 << width) - 1))
+    # Outside the map is water
+    rows += [0] * (block_rows * block_size - height)
+
+    table = []
+    bitmaps = []
+    for block_y in range(0, block_rows):
+        for block_x in range(0, block_row_size):
+            bitmap = [
+                (rows[block_y * block_size + i] >> (block_x * block_size)) & 0xFFFFFFFF
+                for i in range(0, block_size)
+            ]
+
+            if all(row == 0 for row in bitmap):
+                table.append(0)
+            elif all(row == 0xFFFFFFFF for row in bitmap):
+                table.append(1)
+            else:
+                table.append(bitmaps_start + len(bitmaps))
+                bitmaps += bitmap
+
+    out = struct.pack(
+        "<IIIIII",
+        0x4B4D4C42,
+        width,
+        height,
+        block_row_size,
+        block_rows,
+        len(bitmaps) // block_size,
+    )
+    for value in table + bitmaps:
+        out += struct.pack("<I", value)
+
+    return out
+
+
 def create_binary(
     yaml_data: dict,
     tiles: list,
@@ -79,6 +175,7 @@ def create_binary(
     gps_row_length: int,
     gps_rows: int,
     dst_file: str,
+    codec: int,
 ):
     data_size = 0
 
@@ -98,6 +195,16 @@ def create_binary(
     for i in range(0, len(land_mask_yaml_data)):
         land_mask += struct.pack("<I", land_mask_yaml_data[i])
 
+    # The abstract routing graph, generated by the map editor (optional)
+    abstract_graph = b""
+    for value in yaml_data.get("abstract_graph", []):
+        abstract_graph += struct.pack("<I", value)
+
+    # The landmark (ALT) distance tables, generated by the map editor (optional)
+    landmarks = b""
+    for value in yaml_data.get("landmarks", []):
+        landmarks += struct.pack("<I", value)
+
     land_only_tile = Image.new("P", (tile_size, tile_size), 0)
     r = yaml_data["land_pixel_colors"][0]["r"]
     g = yaml_data["land_pixel_colors"][0]["g"]
@@ -108,15 +215,13 @@ def create_binary(
         for x in range(0, land_only_tile.size[0]):
             land_only_tile.putpixel((x, y), (r, g, b))
 
-    output = io.BytesIO()
-    land_only_tile.save(output, format="PNG")
-    bytes = output.getvalue()
+    bytes = encode_tile(land_only_tile, codec)
 
     land_only_size = len(bytes)
 
-    header_format = "<QffffIIIIIIIIII"
+    header_format = "<QffffIIIIIIIIIIIIIIIIII"
     header_size = struct.calcsize(header_format)
-    assert header_size == 64
+    assert header_size == 96
 
     # Starts after the MapMetadata header and all FlashTile:s
     land_only_offset = header_size + len(tiles) * 8
@@ -134,9 +239,7 @@ def create_binary(
             tile_metadata.append((land_only_size, land_only_offset))
             continue
 
-        output = io.BytesIO()
-        tile.save(output, format="PNG")
-        bytes = output.getvalue()
+        bytes = encode_tile(tile, codec)
 
         # Copy bytes to tile_data
         tile_metadata.append((len(bytes), current_offset))
@@ -150,12 +253,14 @@ def create_binary(
     bin_file = open(dst_file, "wb")
 
     # Example data for the header
-    magic = 0x54494C5253574654
+    # TILRSWF2, kMetadataMagic in tile.hh. Change both with the header layout
+    magic = 0x54494C5253574632
     tile_count = len(tiles) + 1
     tile_row_size = row_length
     tile_rows = len(tiles) // row_length
     land_mask_row_size = path_finder_row_length
     land_mask_rows = (tile_rows * tile_size) // path_finder_tile_size
+    block_land_mask = create_block_land_mask(land_mask, land_mask_row_size, land_mask_rows)
     tile_data_offset = header_size  # After the header
     land_mask_data_offset = tile_data_offset + len(tile_metadata) * 8 + len(tile_data)
 
@@ -165,6 +270,21 @@ def create_binary(
 
     gps_data_offset = land_mask_data_offset + len(land_mask)
 
+    # After the GPS data, which keeps the 4 byte alignment
+    abstract_graph_offset = 0
+    if len(abstract_graph) != 0:
+        abstract_graph_offset = gps_data_offset + gps_row_length * gps_rows * 16
+
+    # After the abstract graph (if any)
+    landmarks_offset = 0
+    if len(landmarks) != 0:
+        landmarks_offset = gps_data_offset + gps_row_length * gps_rows * 16 + len(abstract_graph)
+
+    # Last
+    block_land_mask_offset = (
+        gps_data_offset + gps_row_length * gps_rows * 16 + len(abstract_graph) + len(landmarks)
+    )
+
     lowest_latitude = 200
     highest_latitude = -200
     lowest_longitude = 200
@@ -200,6 +320,14 @@ def create_binary(
         tile_data_offset,
         land_mask_data_offset,
         gps_data_offset,
+        abstract_graph_offset,
+        len(abstract_graph),
+        landmarks_offset,
+        len(landmarks),
+        block_land_mask_offset,
+        len(block_land_mask),
+        codec,
+        0,
     )
 
     offset = bin_file.write(header_data)
@@ -234,7 +362,18 @@ def create_binary(
         gps_data[index] = [entry["latitude"], entry["longitude"], entry["latitude_offset"], entry["longitude_offset"]]
 
     for latitude, longitude, latitude_offset, longitude_offset in gps_data:
-        bin_file.write(struct.pack("<ffff", latitude, longitude, latitude_offset, longitude_offset))
+        offset += bin_file.write(struct.pack("<ffff", latitude, longitude, latitude_offset, longitude_offset))
+
+    if len(abstract_graph) != 0:
+        assert offset == abstract_graph_offset
+        offset += bin_file.write(abstract_graph)
+
+    if len(landmarks) != 0:
+        assert offset == landmarks_offset
+        offset += bin_file.write(landmarks)
+
+    assert offset == block_land_mask_offset
+    offset += bin_file.write(block_land_mask)
 
     return data_size
 
@@ -248,11 +387,18 @@ def save_tiles(tiles: list, num_colors):
 
 
 if __name__ == "__main__":
-    if len(sys.argv) != 3:
-        print("Usage: {} <input_yaml_file> <output_file>".format(sys.argv[0]))
+    args = sys.argv[1:]
+    codec = kTileCodecPng
+    if len(args) > 0 and args[0] == "--rle":
+        # Faster to decode than PNG (compare with tile_benchmark)
+        codec = kTileCodecRle
+        args = args[1:]
+
+    if len(args) != 2:
+        print("Usage: {} [--rle] <input_yaml_file> <output_file>".format(sys.argv[0]))
         sys.exit(1)
 
-    yaml_data = yaml.safe_load(open(sys.argv[1], "r"))
+    yaml_data = yaml.safe_load(open(args[0], "r"))
 
     if "map_filename" not in yaml_data or "tile_size" not in yaml_data:
         print(
@@ -288,7 +434,8 @@ if __name__ == "__main__":
         row_length=tile_row_length,
         gps_row_length=gps_row_length,
         gps_rows=gps_rows,
-        dst_file=sys.argv[2],
+        dst_file=args[1],
+        codec=codec,
     )
 
     print(